@@ -0,0 +1,491 @@
+/*
+ * ptebench.c - Unified PTE metadata micro-benchmark driver
+ *
+ * Runs the operations exercised by test1-test10 as named scenarios under one
+ * timing harness: warm-up, optional CPU pinning, one sample per operation,
+ * trimming of the slowest samples, and min/mean/p50/p90/p99/p99.9/max,
+ * printed as text, JSON or CSV. Unlike the standalone tests it is built with
+ * optimization, so the harness itself adds little to the numbers.
+ *
+ * Usage: ./ptebench [OPTIONS] [SCENARIO...]   e.g. ./ptebench -n 100000 -c 2 get-mdp0
+ *        ./ptebench --list
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <sched.h>
+#include <getopt.h>
+
+#include "pte_meta_syscalls.h"
+
+#define DEFAULT_ITERATIONS 10000
+#define DEFAULT_WARMUP     1000
+#define MULTI_PAGES        16           // pages cycled through by set-multi
+#define META_VALUE_BASE    0xCAFEBABEDEADBEEFULL
+
+enum { FORMAT_TEXT, FORMAT_JSON, FORMAT_CSV };
+
+/* State shared by all scenarios */
+struct bench {
+    size_t ps;
+    uint8_t *map;
+    uint8_t *buf;               // first page of the PMD scenarios enable
+    uint8_t *cold;              // page of a PMD that is never enabled
+    uint64_t seq;               // bumped by every op, source of values
+    uint64_t expect;            // value the get scenarios must read back
+    struct {
+        struct metadata_header hdr;
+        uint64_t payload[4];
+    } rec;                      // MDP=1 record
+    uint8_t out[sizeof(struct metadata_header) + 64];
+};
+
+struct scenario {
+    const char *name;
+    const char *test;           // standalone test(s) it comes from
+    const char *desc;
+    int expect_errno;           // 0 if the op must succeed
+    void (*setup)(struct bench *);      // once, untimed
+    void (*pre)(struct bench *);        // before every op, untimed
+    int (*op)(struct bench *);          // timed, 0 or -1 with errno set
+};
+
+struct result {
+    size_t samples;             // after trimming
+    unsigned long errors;
+    double min, mean, stddev, p50, p90, p99, p999, max;
+};
+
+/* ---- scenario operations ---- */
+
+static void enable_buf(struct bench *b)
+{
+    enable_pte_meta((unsigned long)b->buf);
+}
+
+static void disable_buf(struct bench *b)
+{
+    disable_pte_meta((unsigned long)b->buf);
+}
+
+static void setup_get_mdp0(struct bench *b)
+{
+    b->expect = META_VALUE_BASE;
+    enable_buf(b);
+    set_pte_meta((unsigned long)b->buf, 0, (unsigned long)&b->expect);
+}
+
+/*
+ * MDP=1 records use the 16-byte struct metadata_header from
+ * pte_meta_syscalls.h, the layout sysbench's memory test sends and the emul
+ * backend models. test3 sends a packed 8-byte header to the kernel instead,
+ * so these scenarios do not reproduce its kernel path.
+ */
+static void setup_mdp1(struct bench *b)
+{
+    b->rec.hdr.version = 1;
+    b->rec.hdr.type = 0x1234;
+    b->rec.hdr.length = sizeof(b->rec.payload);
+    b->rec.hdr.reserved = 0;
+    for (int i = 0; i < 4; i++)
+        b->rec.payload[i] = META_VALUE_BASE + i;
+    enable_buf(b);
+}
+
+static void setup_get_mdp1(struct bench *b)
+{
+    setup_mdp1(b);
+    set_pte_meta((unsigned long)b->buf, 1, (unsigned long)&b->rec);
+}
+
+static int op_write_page(struct bench *b)
+{
+    const uint8_t base = (uint8_t)++b->seq;
+
+    for (size_t i = 0; i < b->ps; i++)
+        ((volatile uint8_t *)b->buf)[i] = (uint8_t)(base + i);
+    return 0;
+}
+
+static int op_set_mdp0(struct bench *b)
+{
+    uint64_t value = META_VALUE_BASE + ++b->seq;
+
+    return set_pte_meta((unsigned long)b->buf, 0, (unsigned long)&value);
+}
+
+static int op_get_mdp0(struct bench *b)
+{
+    uint64_t value;
+
+    if (get_pte_meta((unsigned long)b->buf, &value) != 0)
+        return -1;
+    if (value != b->expect) {
+        errno = EBADMSG;
+        return -1;
+    }
+    return 0;
+}
+
+static int op_set_mdp1(struct bench *b)
+{
+    b->rec.payload[0] = META_VALUE_BASE + ++b->seq;
+    return set_pte_meta((unsigned long)b->buf, 1, (unsigned long)&b->rec);
+}
+
+static int op_get_mdp1(struct bench *b)
+{
+    if (get_pte_meta((unsigned long)b->buf, b->out) != 0)
+        return -1;
+    if (memcmp(b->out, &b->rec, sizeof(b->rec)) != 0) {
+        errno = EBADMSG;
+        return -1;
+    }
+    return 0;
+}
+
+static int op_get_unexpanded(struct bench *b)
+{
+    uint64_t value;
+
+    return get_pte_meta((unsigned long)b->cold, &value);
+}
+
+static int op_set_multi(struct bench *b)
+{
+    uint64_t value = META_VALUE_BASE + ++b->seq;
+
+    return set_pte_meta((unsigned long)(b->buf + (b->seq % MULTI_PAGES) * b->ps),
+                        0, (unsigned long)&value);
+}
+
+static int op_enable(struct bench *b)
+{
+    return enable_pte_meta((unsigned long)b->buf);
+}
+
+static int op_disable(struct bench *b)
+{
+    return disable_pte_meta((unsigned long)b->buf);
+}
+
+static int op_disable_unexpanded(struct bench *b)
+{
+    return disable_pte_meta((unsigned long)b->cold);
+}
+
+/* Every scenario starts and ends with the PMD of buf collapsed */
+static const struct scenario scenarios[] = {
+    { "write-page", "test1", "write a pattern to one page", 0,
+      NULL, NULL, op_write_page },
+    { "set-mdp0", "test2,test9", "set MDP=0 metadata on an expanded PTE page", 0,
+      enable_buf, NULL, op_set_mdp0 },
+    { "get-mdp0", "test2,test9", "get and check MDP=0 metadata", 0,
+      setup_get_mdp0, NULL, op_get_mdp0 },
+    { "set-mdp1", "test10", "set a 32-byte MDP=1 record, 16-byte header", 0,
+      setup_mdp1, NULL, op_set_mdp1 },
+    { "get-mdp1", "test10", "get and check a 32-byte MDP=1 record, 16-byte header", 0,
+      setup_get_mdp1, NULL, op_get_mdp1 },
+    { "get-unexpanded", "test4", "get on a PTE page never expanded (ENODATA)",
+      ENODATA, NULL, NULL, op_get_unexpanded },
+    { "set-multi", "test5", "set MDP=0 metadata on 16 pages in turn", 0,
+      enable_buf, NULL, op_set_multi },
+    { "enable", "test6", "expand a PTE page", 0,
+      NULL, disable_buf, op_enable },
+    { "disable", "test6", "collapse an expanded PTE page", 0,
+      NULL, enable_buf, op_disable },
+    { "enable-twice", "test6", "enable an expanded PTE page (EEXIST)", EEXIST,
+      enable_buf, NULL, op_enable },
+    { "disable-unexpanded", "test7", "disable a PTE page never expanded (EINVAL)",
+      EINVAL, NULL, NULL, op_disable_unexpanded },
+    { "set-expand", "test8", "first set on a collapsed PTE page (expands it)", 0,
+      NULL, disable_buf, op_set_mdp0 },
+};
+
+#define NR_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+/* ---- harness ---- */
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double pct(const double *sorted, size_t n, double p)
+{
+    return sorted[(size_t)((n - 1) * p)];
+}
+
+/* Does a return value match what the scenario expects? */
+static int op_ok(const struct scenario *sc, int ret)
+{
+    if (sc->expect_errno == 0)
+        return ret == 0;
+    return ret != 0 && errno == sc->expect_errno;
+}
+
+static void run_scenario(const struct scenario *sc, struct bench *b,
+                         long iterations, long warmup, double trim,
+                         double *ns, struct result *r)
+{
+    double sum = 0, sum_sq = 0;
+    size_t n;
+
+    memset(r, 0, sizeof(*r));
+
+    if (sc->setup != NULL)
+        sc->setup(b);
+
+    for (long i = 0; i < warmup; i++) {
+        if (sc->pre != NULL)
+            sc->pre(b);
+        sc->op(b);
+    }
+
+    for (long i = 0; i < iterations; i++) {
+        uint64_t t0, t1;
+        int ret;
+
+        if (sc->pre != NULL)
+            sc->pre(b);
+        t0 = pte_meta_now_ns();
+        ret = sc->op(b);
+        t1 = pte_meta_now_ns();
+
+        if (!op_ok(sc, ret))
+            r->errors++;
+        ns[i] = (double)(t1 - t0);
+    }
+
+    disable_buf(b);
+
+    // Trimming drops the slowest samples: preemption, interrupts, migration
+    qsort(ns, iterations, sizeof(double), cmp_double);
+    n = iterations - (size_t)(iterations * trim / 100.0);
+    if (n == 0)
+        n = 1;
+
+    for (size_t i = 0; i < n; i++) {
+        sum += ns[i];
+        sum_sq += ns[i] * ns[i];
+    }
+    r->samples = n;
+    r->min = ns[0];
+    r->max = ns[n - 1];
+    r->mean = sum / n;
+    r->stddev = sqrt(fmax(sum_sq / n - r->mean * r->mean, 0));
+    r->p50 = pct(ns, n, 0.50);
+    r->p90 = pct(ns, n, 0.90);
+    r->p99 = pct(ns, n, 0.99);
+    r->p999 = pct(ns, n, 0.999);
+}
+
+static void print_result(int format, const struct scenario *sc,
+                         const struct result *r, int first)
+{
+    switch (format) {
+    case FORMAT_TEXT:
+        printf("    %-20s %-12s %8zu %9.0f %9.0f %9.0f %9.0f %9.0f %9.0f %9.0f %9.0f %7lu\n",
+               sc->name, sc->test, r->samples, r->min, r->mean, r->stddev,
+               r->p50, r->p90, r->p99, r->p999, r->max, r->errors);
+        break;
+    case FORMAT_JSON:
+        printf("%s    {\"scenario\": \"%s\", \"test\": \"%s\", \"samples\": %zu, "
+               "\"errors\": %lu, \"min_ns\": %.0f, \"mean_ns\": %.1f, "
+               "\"stddev_ns\": %.1f, \"p50_ns\": %.0f, \"p90_ns\": %.0f, "
+               "\"p99_ns\": %.0f, \"p999_ns\": %.0f, \"max_ns\": %.0f}",
+               first ? "" : ",\n", sc->name, sc->test, r->samples, r->errors,
+               r->min, r->mean, r->stddev, r->p50, r->p90, r->p99, r->p999,
+               r->max);
+        break;
+    case FORMAT_CSV:
+        printf("%s,\"%s\",%zu,%lu,%.0f,%.1f,%.1f,%.0f,%.0f,%.0f,%.0f,%.0f\n",
+               sc->name, sc->test, r->samples, r->errors, r->min, r->mean,
+               r->stddev, r->p50, r->p90, r->p99, r->p999, r->max);
+        break;
+    }
+}
+
+static void usage(const char *prog, FILE *fp)
+{
+    fprintf(fp,
+            "Usage: %s [OPTIONS] [SCENARIO...]\n"
+            "  -n, --iterations=N   timed operations per scenario [%d]\n"
+            "  -w, --warmup=N       untimed operations before timing [%d]\n"
+            "  -c, --cpu=N          pin to CPU N [no pinning]\n"
+            "  -t, --trim=PCT       drop the slowest PCT%% of samples [0]\n"
+            "  -f, --format=FMT     text, json or csv [text]\n"
+            "  -l, --list           list the scenarios and exit\n"
+            "Without SCENARIO, or with 'all', every scenario runs.\n",
+            prog, DEFAULT_ITERATIONS, DEFAULT_WARMUP);
+}
+
+static const struct scenario *find_scenario(const char *name)
+{
+    for (size_t i = 0; i < NR_SCENARIOS; i++)
+        if (!strcmp(scenarios[i].name, name))
+            return &scenarios[i];
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option opts[] = {
+        { "iterations", required_argument, NULL, 'n' },
+        { "warmup",     required_argument, NULL, 'w' },
+        { "cpu",        required_argument, NULL, 'c' },
+        { "trim",       required_argument, NULL, 't' },
+        { "format",     required_argument, NULL, 'f' },
+        { "list",       no_argument,       NULL, 'l' },
+        { "help",       no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const struct scenario *run[NR_SCENARIOS];
+    long iterations = DEFAULT_ITERATIONS, warmup = DEFAULT_WARMUP;
+    int cpu = -1, format = FORMAT_TEXT, c;
+    size_t nrun = 0;
+    unsigned long errors = 0;
+    double trim = 0, *ns;
+    struct bench b = { 0 };
+
+    while ((c = getopt_long(argc, argv, "n:w:c:t:f:lh", opts, NULL)) != -1) {
+        switch (c) {
+        case 'n': iterations = atol(optarg); break;
+        case 'w': warmup = atol(optarg); break;
+        case 'c': cpu = atoi(optarg); break;
+        case 't': trim = atof(optarg); break;
+        case 'f':
+            if (!strcmp(optarg, "text"))
+                format = FORMAT_TEXT;
+            else if (!strcmp(optarg, "json"))
+                format = FORMAT_JSON;
+            else if (!strcmp(optarg, "csv"))
+                format = FORMAT_CSV;
+            else {
+                fprintf(stderr, "Unknown format: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'l':
+            for (size_t i = 0; i < NR_SCENARIOS; i++)
+                printf("%-20s %-12s %s\n", scenarios[i].name, scenarios[i].test,
+                       scenarios[i].desc);
+            return 0;
+        case 'h':
+            usage(argv[0], stdout);
+            return 0;
+        default:
+            usage(argv[0], stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (iterations < 1 || warmup < 0 || trim < 0 || trim >= 100) {
+        usage(argv[0], stderr);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        const struct scenario *sc = find_scenario(argv[i]);
+
+        if (!strcmp(argv[i], "all")) {
+            nrun = 0;
+            break;
+        }
+        if (sc == NULL) {
+            fprintf(stderr, "Unknown scenario: %s (see --list)\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        if (nrun < NR_SCENARIOS)
+            run[nrun++] = sc;
+    }
+    if (nrun == 0)
+        for (size_t i = 0; i < NR_SCENARIOS; i++)
+            run[nrun++] = &scenarios[i];
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            perror("sched_setaffinity");
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Two PMDs: the first is the one scenarios enable, the second never is
+    b.ps = sysconf(_SC_PAGESIZE);
+    b.map = mmap(NULL, 3 * PTE_META_PMD_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ns = malloc(iterations * sizeof(double));
+    if (b.map == MAP_FAILED || ns == NULL) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+    b.buf = (uint8_t *)(((unsigned long)b.map + PTE_META_PMD_SIZE - 1) &
+                        ~(PTE_META_PMD_SIZE - 1));
+    b.cold = b.buf + PTE_META_PMD_SIZE;
+#ifdef MADV_NOHUGEPAGE
+    madvise(b.buf, 2 * PTE_META_PMD_SIZE, MADV_NOHUGEPAGE);
+#endif
+    memset(b.buf, 0x5A, MULTI_PAGES * b.ps);
+    memset(b.cold, 0x5A, b.ps);
+    mlock(b.buf, MULTI_PAGES * b.ps);
+
+    switch (format) {
+    case FORMAT_TEXT:
+        printf("\n=== ptebench: backend %s, %ld iterations, %ld warm-up, ",
+               pte_meta_backend_name(pte_meta_get_backend()), iterations, warmup);
+        if (cpu >= 0)
+            printf("CPU %d, ", cpu);
+        else
+            printf("not pinned, ");
+        printf("%.1f%% trimmed ===\n\n", trim);
+        printf("    %-20s %-12s %8s %9s %9s %9s %9s %9s %9s %9s %9s %7s\n",
+               "scenario", "test", "samples", "min ns", "mean ns", "stddev",
+               "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns", "errors");
+        break;
+    case FORMAT_JSON:
+        printf("{\n  \"backend\": \"%s\",\n  \"iterations\": %ld,\n"
+               "  \"warmup\": %ld,\n  \"cpu\": %d,\n  \"trim_pct\": %.2f,\n"
+               "  \"results\": [\n",
+               pte_meta_backend_name(pte_meta_get_backend()), iterations,
+               warmup, cpu, trim);
+        break;
+    case FORMAT_CSV:
+        printf("scenario,test,samples,errors,min_ns,mean_ns,stddev_ns,"
+               "p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+        break;
+    }
+
+    for (size_t i = 0; i < nrun; i++) {
+        struct result r;
+
+        run_scenario(run[i], &b, iterations, warmup, trim, ns, &r);
+        print_result(format, run[i], &r, i == 0);
+        errors += r.errors;
+        fflush(stdout);
+    }
+
+    if (format == FORMAT_JSON)
+        printf("\n  ]\n}\n");
+    else if (format == FORMAT_TEXT)
+        printf("\n    %s\n", errors == 0 ? "✓ Test completed successfully" :
+               "✗ Some operations returned unexpected results");
+
+    munlock(b.buf, MULTI_PAGES * b.ps);
+    munmap(b.map, 3 * PTE_META_PMD_SIZE);
+    free(ns);
+    return errors == 0 ? 0 : EXIT_FAILURE;
+}
@@ -9,6 +9,16 @@ set -e  # Exit on error
 SYSBENCH_SRC_DIR="./sysbench"  # Sysbench source folder in current directory
 SYSBENCH_PATH="./sysbench_binary"  # Compiled binary name (avoid conflict with source folder)
 TEST_DURATION="--time=30"  # 30 seconds per test
+PTE_BACKEND="${PTE_META_BACKEND:-kernel}"  # PTE metadata backend: kernel or emul
+PTE_GRANULARITY="${PTE_META_GRANULARITY:-word}"  # PTE metadata updates: word, page or event
+PTE_BATCH="${PTE_META_BATCH:-1}"  # PTE metadata operations per vectored submission
+PTE_ASYNC="${PTE_META_ASYNC:-off}"  # on: offload metadata updates to drainer threads
+MEM_WORKING_SET="${MEMORY_WORKING_SET:-0}"  # memory region events select their block from, 0 for a single block
+MEM_PAGE_BACKEND="${MEMORY_PAGE_BACKEND:-4k}"  # 4k, thp-madvise, thp-always, hugetlb-2m or hugetlb-1g
+SB_TIMER="${SYSBENCH_TIMER:-monotonic}"  # timer source: monotonic or tsc
+SB_EVENTS_PER_BATCH="${SYSBENCH_EVENTS_PER_BATCH:-1}"  # events timed as one unit
+MEM_OPTS="--memory-working-set=$MEM_WORKING_SET --memory-page-backend=$MEM_PAGE_BACKEND --timer=$SB_TIMER --events-per-batch=$SB_EVENTS_PER_BATCH"
+PTE_OPTS="--memory-pte-meta=on --memory-pte-meta-backend=$PTE_BACKEND --memory-pte-meta-granularity=$PTE_GRANULARITY --memory-pte-meta-batch=$PTE_BATCH --memory-pte-meta-async=$PTE_ASYNC"
 DATE=$(date +"%Y%m%d_%H%M%S")
 
 # Colors for output
@@ -190,6 +200,11 @@ compile_sysbench() {
 # Function to verify syscall availability
 verify_syscalls() {
     echo -e "${BLUE}🔍 Verifying PTE metadata syscalls...${NC}"
+
+    if [[ "$PTE_BACKEND" == "emul" ]]; then
+        echo -e "${YELLOW}⚠️  Using the userspace emulation backend, kernel syscalls are not used${NC}"
+        return 0
+    fi
     
     # Check if syscalls are available in the kernel
     if [[ ! -f "/proc/kallsyms" ]]; then
@@ -213,6 +228,7 @@ verify_syscalls() {
     if [[ $missing_syscalls -gt 0 ]]; then
         echo -e "${YELLOW}⚠️  Warning: $missing_syscalls syscall(s) missing from kernel${NC}"
         echo "PTE metadata tests will use standard memory operations."
+        echo "Set PTE_META_BACKEND=emul to run them against the userspace emulation."
     else
         echo -e "${GREEN}✅ All PTE metadata syscalls available${NC}"
     fi
@@ -375,6 +391,14 @@ echo "12 Tests Total: 4 scenarios x 3 conditions (no PTE, MDP=0, MDP=1)"
 echo "Date: $(date)"
 echo "Results will be saved to current directory"
 echo "Test duration: $TEST_DURATION"
+echo "PTE metadata backend: $PTE_BACKEND"
+echo "PTE metadata granularity: $PTE_GRANULARITY"
+echo "PTE metadata batch size: $PTE_BATCH"
+echo "PTE metadata async updates: $PTE_ASYNC"
+echo "Memory working set: $MEM_WORKING_SET"
+echo "Memory page backend: $MEM_PAGE_BACKEND"
+echo "Timer source: $SB_TIMER"
+echo "Events per batch: $SB_EVENTS_PER_BATCH"
 echo ""
 
 # Step 1: Check prerequisites
@@ -399,53 +423,53 @@ echo -e "${YELLOW}🔹 Starting Write Tests...${NC}"
 
 # Test 1: Write Sequential - WITHOUT PTE
 run_test "01_write_seq_no_pte" \
-    "$SYSBENCH_PATH $TEST_DURATION --memory-oper=write --memory-access-mode=seq memory run"
+    "$SYSBENCH_PATH $TEST_DURATION $MEM_OPTS --memory-oper=write --memory-access-mode=seq memory run"
 
 # Test 2: Write Sequential - WITH PTE MDP=0 (direct u64)
 run_test "02_write_seq_with_pte_mdp0" \
-    "$SYSBENCH_PATH $TEST_DURATION --memory-oper=write --memory-access-mode=seq --memory-pte-meta=on --memory-pte-meta-type=0 memory run"
+    "$SYSBENCH_PATH $TEST_DURATION $MEM_OPTS --memory-oper=write --memory-access-mode=seq $PTE_OPTS --memory-pte-meta-type=0 memory run"
 
 # Test 3: Write Sequential - WITH PTE MDP=1 (structured)
 run_test "03_write_seq_with_pte_mdp1" \
-    "$SYSBENCH_PATH $TEST_DURATION --memory-oper=write --memory-access-mode=seq --memory-pte-meta=on --memory-pte-meta-type=1 memory run"
+    "$SYSBENCH_PATH $TEST_DURATION $MEM_OPTS --memory-oper=write --memory-access-mode=seq $PTE_OPTS --memory-pte-meta-type=1 memory run"
 
 # Test 4: Write Random - WITHOUT PTE
 run_test "04_write_rnd_no_pte" \
-    "$SYSBENCH_PATH $TEST_DURATION --memory-oper=write --memory-access-mode=rnd memory run"
+    "$SYSBENCH_PATH $TEST_DURATION $MEM_OPTS --memory-oper=write --memory-access-mode=rnd memory run"
 
 # Test 5: Write Random - WITH PTE MDP=0 (direct u64)
 run_test "05_write_rnd_with_pte_mdp0" \
-    "$SYSBENCH_PATH $TEST_DURATION --memory-oper=write --memory-access-mode=rnd --memory-pte-meta=on --memory-pte-meta-type=0 memory run"
+    "$SYSBENCH_PATH $TEST_DURATION $MEM_OPTS --memory-oper=write --memory-access-mode=rnd $PTE_OPTS --memory-pte-meta-type=0 memory run"
 
 # Test 6: Write Random - WITH PTE MDP=1 (structured)
 run_test "06_write_rnd_with_pte_mdp1" \
-    "$SYSBENCH_PATH $TEST_DURATION --memory-oper=write --memory-access-mode=rnd --memory-pte-meta=on --memory-pte-meta-type=1 memory run"
+    "$SYSBENCH_PATH $TEST_DURATION $MEM_OPTS --memory-oper=write --memory-access-mode=rnd $PTE_OPTS --memory-pte-meta-type=1 memory run"
 
 echo -e "${YELLOW}🔹 Starting Read Tests...${NC}"
 
 # Test 7: Read Sequential - WITHOUT PTE
 run_test "07_read_seq_no_pte" \
-    "$SYSBENCH_PATH $TEST_DURATION --memory-oper=read --memory-access-mode=seq memory run"
+    "$SYSBENCH_PATH $TEST_DURATION $MEM_OPTS --memory-oper=read --memory-access-mode=seq memory run"
 
 # Test 8: Read Sequential - WITH PTE MDP=0 (direct u64)
 run_test "08_read_seq_with_pte_mdp0" \
-    "$SYSBENCH_PATH $TEST_DURATION --memory-oper=read --memory-access-mode=seq --memory-pte-meta=on --memory-pte-meta-type=0 memory run"
+    "$SYSBENCH_PATH $TEST_DURATION $MEM_OPTS --memory-oper=read --memory-access-mode=seq $PTE_OPTS --memory-pte-meta-type=0 memory run"
 
 # Test 9: Read Sequential - WITH PTE MDP=1 (structured)
 run_test "09_read_seq_with_pte_mdp1" \
-    "$SYSBENCH_PATH $TEST_DURATION --memory-oper=read --memory-access-mode=seq --memory-pte-meta=on --memory-pte-meta-type=1 memory run"
+    "$SYSBENCH_PATH $TEST_DURATION $MEM_OPTS --memory-oper=read --memory-access-mode=seq $PTE_OPTS --memory-pte-meta-type=1 memory run"
 
 # Test 10: Read Random - WITHOUT PTE
 run_test "10_read_rnd_no_pte" \
-    "$SYSBENCH_PATH $TEST_DURATION --memory-oper=read --memory-access-mode=rnd memory run"
+    "$SYSBENCH_PATH $TEST_DURATION $MEM_OPTS --memory-oper=read --memory-access-mode=rnd memory run"
 
 # Test 11: Read Random - WITH PTE MDP=0 (direct u64)
 run_test "11_read_rnd_with_pte_mdp0" \
-    "$SYSBENCH_PATH $TEST_DURATION --memory-oper=read --memory-access-mode=rnd --memory-pte-meta=on --memory-pte-meta-type=0 memory run"
+    "$SYSBENCH_PATH $TEST_DURATION $MEM_OPTS --memory-oper=read --memory-access-mode=rnd $PTE_OPTS --memory-pte-meta-type=0 memory run"
 
 # Test 12: Read Random - WITH PTE MDP=1 (structured)
 run_test "12_read_rnd_with_pte_mdp1" \
-    "$SYSBENCH_PATH $TEST_DURATION --memory-oper=read --memory-access-mode=rnd --memory-pte-meta=on --memory-pte-meta-type=1 memory run"
+    "$SYSBENCH_PATH $TEST_DURATION $MEM_OPTS --memory-oper=read --memory-access-mode=rnd $PTE_OPTS --memory-pte-meta-type=1 memory run"
 
 echo -e "${YELLOW}🔹 Generating Summary Report...${NC}"
 
@@ -455,6 +479,7 @@ SUMMARY_FILE="summary_${DATE}.txt"
     echo "=== PTE Metadata Performance Test Summary ==="
     echo "Date: $(date)"
     echo "Test Duration: $TEST_DURATION"
+    echo "PTE Metadata Backend: $PTE_BACKEND"
     echo ""
     echo "System Information:"
     echo "OS: $(uname -a)"
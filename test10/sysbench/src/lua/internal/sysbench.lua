@@ -92,6 +92,19 @@ end
 -- script to replace the default human-readable reports
 --
 -- sysbench.hooks.report_intermediate = sysbench.report_json
+--
+-- With --rate-response-time the response time percentile is reported as well,
+-- and cumulative reports add service and response time percentiles
+local pct_names = { "p50", "p90", "p99", "p99.9", "p99.99", "max" }
+
+local function json_pcts(name, pcts)
+   local items = {}
+   for i, pname in ipairs(pct_names) do
+      items[i] = ('"%s": %4.2f'):format(pname, pcts[pname] * 1000)
+   end
+   return ('    "%s": { %s },\n'):format(name, table.concat(items, ", "))
+end
+
 function sysbench.report_json(stat)
    if not gobj then
       io.write('[\n')
@@ -104,6 +117,16 @@ function sysbench.report_json(stat)
    end
 
    local seconds = stat.time_interval
+   local response = ""
+   if stat.response_time_pct ~= nil then
+      response = ('    "response_time": %4.2f,\n'):format(
+         stat.response_time_pct * 1000)
+   end
+   if stat.service_time_pcts ~= nil then
+      response = response ..
+         json_pcts("service_time_pcts", stat.service_time_pcts) ..
+         json_pcts("response_time_pcts", stat.response_time_pcts)
+   end
    io.write(([[
   {
     "time": %4.0f,
@@ -116,7 +139,7 @@ function sysbench.report_json(stat)
       "other": %4.2f
     },
     "latency": %4.2f,
-    "errors": %4.2f,
+%s    "errors": %4.2f,
     "reconnects": %4.2f
   }]]):format(
             stat.time_total,
@@ -127,6 +150,7 @@ function sysbench.report_json(stat)
             stat.writes / seconds,
             stat.other / seconds,
             stat.latency_pct * 1000,
+            response,
             stat.errors / seconds,
             stat.reconnects / seconds
    ))
@@ -33,7 +33,7 @@
 #include "sysbench.h"
 #include "sb_histogram.h"
 #include "sb_logger.h"
-#include "sb_rand.h"
+#include "sb_timer.h"
 
 #include "sb_ck_pr.h"
 #include "ck_cc.h"
@@ -41,47 +41,65 @@
 #include "sb_util.h"
 
 
-/*
-   Number of slots for current histogram array. TODO: replace this constant with
-   some autodetection code based on the number of available cores or some such.
-*/
-#define SB_HISTOGRAM_NSLOTS 128
-
 /* Global latency histogram */
 sb_histogram_t sb_latency_histogram CK_CC_CACHELINE;
 
+/* Global response time histogram */
+sb_histogram_t sb_response_histogram CK_CC_CACHELINE;
 
-int sb_histogram_init(sb_histogram_t *h, size_t size,
-                      double range_min, double range_max)
+
+/*
+  Allocate per-thread shards and the report arrays for a histogram with
+  h->array_size elements.
+*/
+static int alloc_arrays(sb_histogram_t *h)
 {
-  size_t i;
+  const size_t size = h->array_size;
   uint64_t *tmp;
 
-  /* Allocate memory for cumulative_array + temp_array + all slot arrays */
-  tmp = (uint64_t *) calloc(size * (SB_HISTOGRAM_NSLOTS + 2), sizeof(uint64_t));
-  h->interm_slots = (uint64_t **) malloc(SB_HISTOGRAM_NSLOTS *
-                                         sizeof(uint64_t *));
+  h->nshards = sb_globals.threads + 1;
+  h->shard_stride = SB_ALIGN(size * sizeof(uint64_t), CK_MD_CACHELINE) /
+    sizeof(uint64_t);
 
-  if (tmp == NULL || h->interm_slots == NULL)
+  /* cumulative_array + cumulative_base + interm_base + temp_array */
+  tmp = (uint64_t *) calloc(size * 4, sizeof(uint64_t));
+  h->shards = (uint64_t *) sb_memalign(h->nshards * h->shard_stride *
+                                       sizeof(uint64_t), CK_MD_CACHELINE);
+
+  if (tmp == NULL || h->shards == NULL)
   {
     log_text(LOG_FATAL,
              "Failed to allocate memory for a histogram object, size = %zd",
              size);
+    free(tmp);
+    free(h->shards);
     return 1;
   }
 
+  memset(h->shards, 0, h->nshards * h->shard_stride * sizeof(uint64_t));
+
   h->cumulative_array = tmp;
   tmp += size;
 
-  h->temp_array = tmp;
+  h->cumulative_base = tmp;
   tmp += size;
 
-  for (i = 0; i < SB_HISTOGRAM_NSLOTS; i++)
-  {
-    h->interm_slots[i] = tmp;
-    tmp += size;
-  }
+  h->interm_base = tmp;
+  tmp += size;
+
+  h->temp_array = tmp;
 
+  h->cumulative_nevents = 0;
+
+  pthread_rwlock_init(&h->lock, NULL);
+
+  return 0;
+}
+
+
+int sb_histogram_init(sb_histogram_t *h, size_t size,
+                      double range_min, double range_max)
+{
   h->range_deduct = log(range_min);
   h->range_mult = (size - 1) / (log(range_max) - h->range_deduct);
 
@@ -89,19 +107,116 @@ int sb_histogram_init(sb_histogram_t *h, size_t size,
   h->range_max = range_max;
 
   h->array_size = size;
+  h->ns_sub_bits = 0;
 
-  pthread_rwlock_init(&h->lock, NULL);
+  return alloc_arrays(h);
+}
 
-  return 0;
+
+/*
+  Bucket index of a nanosecond value: values below 2^(sub_bits + 1) get a
+  bucket each, larger ones are split into 2^sub_bits buckets per power of two.
+*/
+static inline size_t ns_index(unsigned int sub_bits, uint64_t ns)
+{
+  const uint64_t sub = (uint64_t) 1 << sub_bits;
+  unsigned int   msb;
+
+  if (ns < 2 * sub)
+    return ns;
+
+  msb = 63 - __builtin_clzll(ns);
+
+  return 2 * sub + (msb - sub_bits - 1) * sub +
+    ((ns >> (msb - sub_bits)) & (sub - 1));
+}
+
+
+/* Smallest nanosecond value counted in bucket i, and the bucket's width */
+static uint64_t ns_bucket_low(unsigned int sub_bits, size_t i, uint64_t *width)
+{
+  const uint64_t sub = (uint64_t) 1 << sub_bits;
+  unsigned int   shift;
+
+  if (i < 2 * sub)
+  {
+    *width = 1;
+    return i;
+  }
+
+  shift = (i - 2 * sub) / sub + 1;
+  *width = (uint64_t) 1 << shift;
+
+  return (sub + (i - 2 * sub) % sub) << shift;
+}
+
+
+int sb_histogram_init_ns(sb_histogram_t *h, unsigned int sub_bits,
+                         uint64_t max_ns)
+{
+  h->ns_sub_bits = sub_bits;
+  h->array_size = ns_index(sub_bits, max_ns) + 1;
+
+  h->range_min = 0;
+  h->range_max = NS2MS(max_ns);
+  h->range_deduct = 0;
+  h->range_mult = 0;
+
+  return alloc_arrays(h);
+}
+
+
+/* Representative value of bucket i, in the histogram's reporting units */
+static double bucket_value(sb_histogram_t *h, size_t i)
+{
+  uint64_t low, width;
+
+  if (h->ns_sub_bits == 0)
+    return exp(i / h->range_mult + h->range_deduct);
+
+  low = ns_bucket_low(h->ns_sub_bits, i, &width);
+
+  return NS2MS(low + (width - 1) / 2.0);
+}
+
+
+/*
+  Add n to element i of the calling thread's shard. Worker threads own their
+  shards, so a plain load and store is enough. Background threads share the
+  last shard and need an atomic add.
+*/
+static inline void shard_add(sb_histogram_t *h, size_t i, uint64_t n)
+{
+  size_t    shard = (size_t) sb_tls_thread_id;
+  uint64_t *ptr;
+
+  if (SB_UNLIKELY(shard >= h->nshards - 1))
+  {
+    ptr = h->shards + (h->nshards - 1) * h->shard_stride + i;
+    ck_pr_add_64(ptr, n);
+    return;
+  }
+
+  ptr = h->shards + shard * h->shard_stride + i;
+  ck_pr_store_64(ptr, ck_pr_load_64(ptr) + n);
 }
 
 
 void sb_histogram_update(sb_histogram_t *h, double value)
 {
-  size_t      slot;
+  sb_histogram_update_n(h, value, 1);
+}
+
+
+void sb_histogram_update_n(sb_histogram_t *h, double value, uint64_t n)
+{
   ssize_t     i;
 
-  slot = sb_rand_uniform_uint64() % SB_HISTOGRAM_NSLOTS;
+  if (h->ns_sub_bits > 0)
+  {
+    sb_histogram_update_ns(h, value * NS_PER_MS, n);
+    return;
+  }
 
   i = floor((log(value) - h->range_deduct) * h->range_mult + 0.5);
   if (SB_UNLIKELY(i < 0))
@@ -109,132 +224,130 @@ void sb_histogram_update(sb_histogram_t *h, double value)
   else if (SB_UNLIKELY(i >= (ssize_t) (h->array_size)))
     i = h->array_size - 1;
 
-  ck_pr_inc_64(&h->interm_slots[slot][i]);
+  shard_add(h, i, n);
 }
 
 
-double sb_histogram_get_pct_intermediate(sb_histogram_t *h,
-                                         double percentile)
+void sb_histogram_update_ns(sb_histogram_t *h, uint64_t ns, uint64_t n)
 {
-  size_t   i, s;
-  uint64_t nevents, ncur, nmax;
-  double   res;
+  size_t i = ns_index(h->ns_sub_bits, ns);
 
-  nevents = 0;
+  if (SB_UNLIKELY(i >= h->array_size))
+    i = h->array_size - 1;
 
-  /*
-    This can be called concurrently with other sb_histogram_get_pct_*()
-    functions, so use the lock to protect shared structures. This will not block
-    sb_histogram_update() calls, but we make sure we don't lose any concurrent
-    increments by atomically fetching each array element and replacing it with
-    0.
-  */
-  pthread_rwlock_wrlock(&h->lock);
+  shard_add(h, i, n);
+}
+
+
+/*
+  Sum all shards into temp_array. This should be called with the histogram lock
+  write-locked.
+*/
+static void sum_shards(sb_histogram_t *h)
+{
+  size_t   i, s;
 
-  /*
-    Merge intermediate slots into temp_array.
-  */
   const size_t size = h->array_size;
   uint64_t * const array = h->temp_array;
 
   for (i = 0; i < size; i++)
-  {
-    array[i] = ck_pr_fas_64(&h->interm_slots[0][i], 0);
-    nevents += array[i];
-  }
+    array[i] = ck_pr_load_64(&h->shards[i]);
 
-  for (s = 1; s < SB_HISTOGRAM_NSLOTS; s++)
+  for (s = 1; s < h->nshards; s++)
   {
+    const uint64_t * const shard = h->shards + s * h->shard_stride;
+
     for (i = 0; i < size; i++)
-    {
-      uint64_t t;
+      array[i] += ck_pr_load_64(&shard[i]);
+  }
+}
 
-      t = ck_pr_fas_64(&h->interm_slots[s][i], 0);
 
-      array[i] += t;
-      nevents += t;
-    }
-  }
+/*
+  Calculate a given percentile from an array with nevents events in total.
+*/
+static double get_pct(sb_histogram_t *h, const uint64_t *array,
+                      uint64_t nevents, double percentile)
+{
+  size_t   i;
+  uint64_t ncur, nmax;
 
-  /*
-    Now that we have an aggregate 'snapshot' of current arrays and the total
-    number of events in it, calculate the current, intermediate percentile value
-    to return.
-  */
   nmax = floor(nevents * percentile / 100 + 0.5);
 
   ncur = 0;
-  for (i = 0; i < size; i++)
+  for (i = 0; i < h->array_size - 1; i++)
   {
     ncur += array[i];
     if (ncur >= nmax)
       break;
   }
 
-  res = exp(i / h->range_mult + h->range_deduct);
-
-  /* Finally, add temp_array into accumulated values in cumulative_array. */
-  for (i = 0; i < size; i++)
-  {
-    h->cumulative_array[i] += array[i];
-  }
-
-  h->cumulative_nevents += nevents;
-
-  pthread_rwlock_unlock(&h->lock);
-
-  return res;
+  return bucket_value(h, i);
 }
 
 
-/*
-  Aggregate arrays from intermediate slots into cumulative_array. This should be
-  called with the histogram lock write-locked.
-*/
-static void merge_intermediate_into_cumulative(sb_histogram_t *h)
+double sb_histogram_get_pct_intermediate(sb_histogram_t *h,
+                                         double percentile)
 {
-  size_t   i, s;
+  size_t   i;
   uint64_t nevents;
+  double   res;
 
-  nevents = h->cumulative_nevents;
+  /*
+    This can be called concurrently with other sb_histogram_get_pct_*()
+    functions, so use the lock to protect shared structures. This will not block
+    sb_histogram_update() calls, which only ever increment shard elements.
+  */
+  pthread_rwlock_wrlock(&h->lock);
+
+  sum_shards(h);
 
+  /*
+    Replace shard totals in temp_array with the increments since the last call,
+    and remember the totals for the next one.
+  */
   const size_t size = h->array_size;
-  uint64_t * const array = h->cumulative_array;
+  uint64_t * const array = h->temp_array;
 
-  for (s = 0; s < SB_HISTOGRAM_NSLOTS; s++)
+  nevents = 0;
+  for (i = 0; i < size; i++)
   {
-    for (i = 0; i < size; i++)
-    {
-      uint64_t t = ck_pr_fas_64(&h->interm_slots[s][i], 0);
-      array[i] += t;
-      nevents += t;
-    }
+    const uint64_t total = array[i];
+
+    array[i] = total - h->interm_base[i];
+    h->interm_base[i] = total;
+    nevents += array[i];
   }
 
-  h->cumulative_nevents = nevents;
+  res = get_pct(h, array, nevents, percentile);
+
+  pthread_rwlock_unlock(&h->lock);
+
+  return res;
 }
 
 
 /*
-  Calculate a given percentile from the cumulative array. This should be called
-  with the histogram lock either read- or write-locked.
+  Update cumulative_array with the values recorded since the last checkpoint.
+  This should be called with the histogram lock write-locked.
 */
-static double get_pct_cumulative(sb_histogram_t *h, double percentile)
+static void update_cumulative(sb_histogram_t *h)
 {
   size_t   i;
-  uint64_t ncur, nmax;
+  uint64_t nevents;
 
-  nmax = floor(h->cumulative_nevents * percentile / 100 + 0.5);
+  sum_shards(h);
 
-  ncur = 0;
-  for (i = 0; i < h->array_size; i++)
+  const size_t size = h->array_size;
+
+  nevents = 0;
+  for (i = 0; i < size; i++)
   {
-    ncur += h->cumulative_array[i];
-    if (ncur >= nmax)
-      break;
+    h->cumulative_array[i] = h->temp_array[i] - h->cumulative_base[i];
+    nevents += h->cumulative_array[i];
   }
 
-  return exp(i / h->range_mult + h->range_deduct);
+  h->cumulative_nevents = nevents;
 }
 
 
@@ -245,15 +358,13 @@ double sb_histogram_get_pct_cumulative(sb_histogram_t *h, double percentile)
   /*
     This can be called concurrently with other sb_histogram_get_pct_*()
     functions, so use the lock to protect shared structures. This will not block
-    sb_histogram_update() calls, but we make sure we don't lose any concurrent
-    increments by atomically fetching each array element and replacing it with
-    0.
+    sb_histogram_update() calls.
   */
   pthread_rwlock_wrlock(&h->lock);
 
-  merge_intermediate_into_cumulative(h);
+  update_cumulative(h);
 
-  res = get_pct_cumulative(h, percentile);
+  res = get_pct(h, h->cumulative_array, h->cumulative_nevents, percentile);
 
   pthread_rwlock_unlock(&h->lock);
 
@@ -266,26 +377,38 @@ double sb_histogram_get_pct_checkpoint(sb_histogram_t *h,
 {
   double   res;
 
+  sb_histogram_get_pcts_checkpoint(h, 1, &percentile, &res);
+
+  return res;
+}
+
+
+void sb_histogram_get_pcts_checkpoint(sb_histogram_t *h, size_t n,
+                                      const double *percentiles,
+                                      double *values)
+{
+  size_t   i;
+
   /*
     This can be called concurrently with other sb_histogram_get_pct_*()
     functions, so use the lock to protect shared structures. This will not block
-    sb_histogram_update() calls, but we make sure we don't lose any concurrent
-    increments by atomically fetching each array element and replacing it with
-    0.
+    sb_histogram_update() calls. Updates after the shards were summed are
+    accounted in the next checkpoint.
   */
   pthread_rwlock_wrlock(&h->lock);
 
-  merge_intermediate_into_cumulative(h);
+  update_cumulative(h);
 
-  res = get_pct_cumulative(h, percentile);
+  for (i = 0; i < n; i++)
+    values[i] = get_pct(h, h->cumulative_array, h->cumulative_nevents,
+                        percentiles[i]);
 
-  /* Reset the cumulative array */
+  /* Reset cumulative stats by moving the base to the current totals */
+  memcpy(h->cumulative_base, h->temp_array, h->array_size * sizeof(uint64_t));
   memset(h->cumulative_array, 0, h->array_size * sizeof(uint64_t));
   h->cumulative_nevents = 0;
 
   pthread_rwlock_unlock(&h->lock);
-
-  return res;
 }
 
 
@@ -297,7 +420,7 @@ void sb_histogram_print(sb_histogram_t *h)
 
   pthread_rwlock_wrlock(&h->lock);
 
-  merge_intermediate_into_cumulative(h);
+  update_cumulative(h);
 
   uint64_t * const array = h->cumulative_array;
 
@@ -309,7 +432,10 @@ void sb_histogram_print(sb_histogram_t *h)
   }
 
   if (maxcnt == 0)
+  {
+    pthread_rwlock_unlock(&h->lock);
     return;
+  }
 
   printf("       value  ------------- distribution ------------- count\n");
 
@@ -321,7 +447,7 @@ void sb_histogram_print(sb_histogram_t *h)
     width = floor(array[i] * (double) 40 / maxcnt + 0.5);
 
     printf("%12.3f |%-40.*s %lu\n",
-           exp(i / h->range_mult + h->range_deduct),          /* value */
+           bucket_value(h, i),                                /* value */
            width, "****************************************", /* distribution */
            (unsigned long) array[i]);                /* count */
   }
@@ -335,7 +461,7 @@ void sb_histogram_done(sb_histogram_t *h)
   pthread_rwlock_destroy(&h->lock);
 
   free(h->cumulative_array);
-  free(h->interm_slots);
+  free(h->shards);
 }
 
 /*
@@ -25,29 +25,46 @@
 #endif
 
 typedef struct {
+  /*
+     Per-thread shards of bucket counters, one per worker thread plus one
+     shared by background threads. Each shard is only ever incremented, by its
+     owner thread with plain stores, and is padded to a multiple of the cache
+     line size. sb_histogram_get_pct_*() functions sum the shards and work out
+     the intermediate and cumulative counts as differences against the bases
+     below.
+  */
+  uint64_t              *shards;
+  /* Number of shards */
+  size_t                nshards;
+  /* Distance in elements between consecutive shards */
+  size_t                shard_stride;
   /*
      Cumulative histogram array. Updated 'on demand' by
-     sb_histogram_get_pct_intermediate(). Protected by 'lock'.
+     sb_histogram_get_pct_cumulative(). Protected by 'lock'.
   */
   uint64_t              *cumulative_array;
   /*
      Total number of events in cumulative_array. Updated on demand by
-     sb_histogram_get_pct_intermediate(). Protected by 'lock'.
+     sb_histogram_get_pct_cumulative(). Protected by 'lock'.
   */
   uint64_t              cumulative_nevents;
+  /* Shard totals at the last checkpoint reset. Protected by 'lock'. */
+  uint64_t              *cumulative_base;
+  /* Shard totals at the last intermediate report. Protected by 'lock'. */
+  uint64_t              *interm_base;
   /*
-    Temporary array for intermediate percentile calculations. Protected by
-    'lock'.
+    Temporary array for summing shards and intermediate percentile
+    calculations. Protected by 'lock'.
   */
   uint64_t              *temp_array;
-  /*
-     Intermediate histogram values are split into multiple slots and updated
-     with atomics. Aggregations into cumulative values is performed by
-     sb_histogram_get_pct_intermediate() function.
-  */
-  uint64_t              **interm_slots;
   /* Number of elements in each array */
   size_t                array_size;
+  /*
+     Number of linear sub-buckets per power of two, as a power of two, for
+     histograms of nanosecond values created with sb_histogram_init_ns(). 0 for
+     logarithmic histograms of double values created with sb_histogram_init().
+  */
+  unsigned int          ns_sub_bits;
   /* Lower bound of values to track */
   double                range_min;
   /* Upper bound of values to track */
@@ -57,8 +74,8 @@ typedef struct {
   /* Value to multiply to calculate histogram range based array element */
   double                range_mult;
   /*
-     rwlock to protect cumulative_array and cumulative_nevents from concurrent
-     updates.
+     rwlock to protect cumulative and temporary arrays from concurrent
+     percentile calculations.
   */
   pthread_rwlock_t      lock;
 } sb_histogram_t;
@@ -66,6 +83,9 @@ typedef struct {
 /* Global latency histogram */
 extern sb_histogram_t sb_latency_histogram;
 
+/* Global response time histogram, used with --rate-response-time */
+extern sb_histogram_t sb_response_histogram;
+
 /*
   Allocate a new histogram and initialize it with sb_histogram_init().
 */
@@ -83,19 +103,36 @@ void sb_histogram_delete(sb_histogram_t *h);
 int sb_histogram_init(sb_histogram_t *h, size_t size,
                       double range_min, double range_max);
 
+/*
+  Initialize a histogram of integer nanosecond values up to max_ns. Buckets are
+  log-linear, with 2^sub_bits buckets per power of two, so the relative error
+  is below 2^-sub_bits. Percentiles and printed values are in milliseconds.
+*/
+int sb_histogram_init_ns(sb_histogram_t *h, unsigned int sub_bits,
+                         uint64_t max_ns);
+
 /* Update histogram with a given value. */
 void sb_histogram_update(sb_histogram_t *h, double value);
 
+/* Update histogram with n occurrences of a given value. */
+void sb_histogram_update_n(sb_histogram_t *h, double value, uint64_t n);
+
+/*
+  Update a histogram created with sb_histogram_init_ns() with n occurrences of
+  a given nanosecond value. Uses only integer math and, for worker threads, no
+  atomic read-modify-write operations.
+*/
+void sb_histogram_update_ns(sb_histogram_t *h, uint64_t ns, uint64_t n);
+
 /*
-  Calculate a given percentile value from the intermediate histogram values,
-  then merge intermediate values into cumulative ones atomically, i.e. in a way
-  that no concurrent updates are lost and will be accounted in either the
-  current or later merge of intermediate clues.
+  Calculate a given percentile value from the values recorded since the
+  previous call. Concurrent updates are never lost, they are accounted in
+  either the current or the next call.
 */
 double sb_histogram_get_pct_intermediate(sb_histogram_t *h, double percentile);
 
 /*
-  Merge intermediate histogram values into cumulative ones and calculate a given
+  Sum the per-thread shards into cumulative values and calculate a given
   percentile value from the cumulative array.
 */
 double sb_histogram_get_pct_cumulative(sb_histogram_t *h, double percentile);
@@ -108,6 +145,14 @@ double sb_histogram_get_pct_cumulative(sb_histogram_t *h, double percentile);
 */
 double sb_histogram_get_pct_checkpoint(sb_histogram_t *h, double percentile);
 
+/*
+  Same as sb_histogram_get_pct_checkpoint(), but calculates n percentiles from
+  the same cumulative stats into values[].
+*/
+void sb_histogram_get_pcts_checkpoint(sb_histogram_t *h, size_t n,
+                                      const double *percentiles,
+                                      double *values);
+
 /*
   Print a given histogram to stdout
 */
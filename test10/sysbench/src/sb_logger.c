@@ -43,12 +43,11 @@
 #define ERROR_BUFFER_SIZE 256
 
 /*
-   Use 1024-element array for latency histogram tracking values between 0.001
-   milliseconds and 100 seconds.
+   Track latencies up to 100 seconds in nanoseconds. The number of buckets per
+   power of two is set by --histogram-digits.
 */
-#define OPER_LOG_GRANULARITY 1024
-#define OPER_LOG_MIN_VALUE   1e-3
-#define OPER_LOG_MAX_VALUE   1E5
+#define OPER_LOG_MAX_NS      100000000000ULL
+#define OPER_LOG_MAX_DIGITS  3
 
 /* Array of message handlers (one chain per message type) */
 
@@ -98,6 +97,8 @@ static sb_arg_t oper_handler_args[] =
          "Use the special value of 0 to disable percentile calculations",
          "95", INT),
   SB_OPT("histogram", "print latency histogram in report", "off", BOOL),
+  SB_OPT("histogram-digits", "number of significant decimal digits kept by "
+         "latency histograms (1-3)", "2", INT),
 
   SB_OPT_END
 };
@@ -464,6 +465,7 @@ int text_handler_process(log_msg_t *msg)
 int oper_handler_init(void)
 {
   int          tmp;
+  unsigned int sub_bits;
 
   tmp = sb_get_value_int("percentile");
   if (tmp < 0 || tmp > 100)
@@ -481,8 +483,29 @@ int oper_handler_init(void)
     return 1;
   }
 
-  if (sb_histogram_init(&sb_latency_histogram, OPER_LOG_GRANULARITY,
-                        OPER_LOG_MIN_VALUE, OPER_LOG_MAX_VALUE))
+  if (sb_globals.percentile == 0 && sb_globals.response_time)
+  {
+    log_text(LOG_FATAL,
+             "--rate-response-time cannot be used with --percentile=0");
+    return 1;
+  }
+
+  tmp = sb_get_value_int("histogram-digits");
+  if (tmp < 1 || tmp > OPER_LOG_MAX_DIGITS)
+  {
+    log_text(LOG_FATAL, "Invalid value for --histogram-digits: %d", tmp);
+    return 1;
+  }
+
+  /* Smallest power of two of buckets per power of two covering 10^digits */
+  for (sub_bits = 0; (1U << sub_bits) < pow(10, tmp); sub_bits++)
+    ;
+
+  if (sb_histogram_init_ns(&sb_latency_histogram, sub_bits, OPER_LOG_MAX_NS))
+    return 1;
+
+  if (sb_globals.response_time &&
+      sb_histogram_init_ns(&sb_response_histogram, sub_bits, OPER_LOG_MAX_NS))
     return 1;
 
   return 0;
@@ -495,5 +518,8 @@ int oper_handler_done(void)
 {
   sb_histogram_done(&sb_latency_histogram);
 
+  if (sb_globals.response_time)
+    sb_histogram_done(&sb_response_histogram);
+
   return 0;
 }
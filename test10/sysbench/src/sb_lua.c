@@ -1003,6 +1003,17 @@ int sb_lua_call_custom_command(const char *name)
 
 #define stat_to_number(name) sb_lua_var_number(L, #name, stat->name)
 
+/* Export values at sb_report_pcts[] as a table keyed by percentile names */
+static void stat_pcts_to_table(lua_State *L, const char *name,
+                               const double *pcts)
+{
+  lua_pushstring(L, name);
+  lua_newtable(L);
+  for (unsigned i = 0; i < SB_REPORT_NPCTS; i++)
+    sb_lua_var_number(L, sb_report_pct_names[i], pcts[i]);
+  lua_settable(L, -3);
+}
+
 static void stat_to_lua_table(lua_State *L, sb_stat_t *stat)
 {
   lua_newtable(L);
@@ -1010,6 +1021,8 @@ static void stat_to_lua_table(lua_State *L, sb_stat_t *stat)
   stat_to_number(time_interval);
   stat_to_number(time_total);
   stat_to_number(latency_pct);
+  if (sb_globals.response_time)
+    stat_to_number(response_time_pct);
   stat_to_number(events);
   stat_to_number(reads);
   stat_to_number(writes);
@@ -1067,6 +1080,12 @@ static void sb_lua_report_cumulative(sb_stat_t *stat)
   stat_to_number(latency_avg);
   stat_to_number(latency_sum);
 
+  if (sb_globals.response_time)
+  {
+    stat_pcts_to_table(L, "service_time_pcts", stat->service_time_pcts);
+    stat_pcts_to_table(L, "response_time_pcts", stat->response_time_pcts);
+  }
+
   if (lua_pcall(L, 1, 0, 0))
   {
     call_error(L, REPORT_CUMULATIVE_HOOK);
@@ -32,6 +32,91 @@
 #include "sb_timer.h"
 #include "sb_util.h"
 
+#if defined(SB_HAVE_TSC) && defined(__x86_64__)
+# include <cpuid.h>
+#endif
+
+/* Time spent calibrating the cycle counter against CLOCK_MONOTONIC */
+#define SB_TSC_CALIBRATION_NS (50 * NS_PER_MS)
+
+sb_timer_clock_t sb_timer_clock = { .source = SB_TIMER_SOURCE_MONOTONIC };
+
+#ifdef SB_HAVE_TSC
+
+/*
+  The counter must tick at a constant rate in all power states and be
+  synchronized across CPUs. On x86 that is the invariant TSC bit, the arm64
+  generic timer is constant-rate by definition.
+*/
+static bool sb_tsc_invariant(void)
+{
+# if defined(__x86_64__)
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    return false;
+  return (edx & (1U << 8)) != 0;
+# else
+  return true;
+# endif
+}
+
+/* Measure the counter frequency against CLOCK_MONOTONIC */
+static void sb_tsc_calibrate(void)
+{
+  struct timespec t0, t1;
+  uint64_t        c0, c1, ns;
+
+  c0 = sb_tsc_read();
+  SB_GETTIME(&t0);
+  sb_nanosleep(SB_TSC_CALIBRATION_NS);
+  c1 = sb_tsc_read();
+  SB_GETTIME(&t1);
+
+  ns = TIMESPEC_DIFF(t1, t0);
+
+  sb_timer_clock.mult = (uint64_t) (((unsigned __int128) ns << 32) / (c1 - c0));
+  sb_timer_clock.tsc_base = c1;
+  sb_timer_clock.ns_base = SEC2NS(t1.tv_sec) + t1.tv_nsec;
+  sb_timer_clock.tsc_mhz = (c1 - c0) * 1000.0 / ns;
+}
+
+#endif /* SB_HAVE_TSC */
+
+int sb_timer_set_source(const char *name)
+{
+  if (!strcmp(name, "monotonic"))
+  {
+    sb_timer_clock.source = SB_TIMER_SOURCE_MONOTONIC;
+    return 0;
+  }
+
+  if (strcmp(name, "tsc"))
+    return 1;
+
+#ifdef SB_HAVE_TSC
+  if (sb_tsc_invariant())
+  {
+    sb_tsc_calibrate();
+    sb_timer_clock.source = SB_TIMER_SOURCE_TSC;
+    return 0;
+  }
+  log_text(LOG_WARNING, "The CPU does not report an invariant TSC, "
+           "using CLOCK_MONOTONIC for timers");
+#else
+  log_text(LOG_WARNING, "No cycle counter support on this platform, "
+           "using CLOCK_MONOTONIC for timers");
+#endif
+  sb_timer_clock.source = SB_TIMER_SOURCE_MONOTONIC;
+
+  return 0;
+}
+
+const char *sb_timer_source_name(void)
+{
+  return sb_timer_clock.source == SB_TIMER_SOURCE_TSC ? "tsc" : "monotonic";
+}
+
 /* Some functions for simple time operations */
 
 /* initialize timer */
@@ -40,8 +125,8 @@ void sb_timer_init(sb_timer_t *t)
 {
   SB_COMPILE_TIME_ASSERT(sizeof(sb_timer_t) % CK_MD_CACHELINE == 0);
 
-  memset(&t->time_start, 0, sizeof(struct timespec));
-  memset(&t->time_end, 0, sizeof(struct timespec));
+  t->time_start = 0;
+  t->time_end = 0;
 
   ck_spinlock_init(&t->lock);
 
@@ -72,7 +157,7 @@ void sb_timer_copy(sb_timer_t *to, sb_timer_t *from)
 
 bool sb_timer_running(sb_timer_t *t)
 {
-  return TIMESPEC_DIFF(t->time_start, t->time_end) > 0;
+  return t->time_start > t->time_end;
 }
 
 /*
@@ -83,11 +168,10 @@ bool sb_timer_running(sb_timer_t *t)
 
 uint64_t sb_timer_current(sb_timer_t *t)
 {
-  struct timespec tmp;
-  uint64_t        res;
+  uint64_t tmp = sb_timer_now();
+  uint64_t res;
 
-  SB_GETTIME(&tmp);
-  res = TIMESPEC_DIFF(tmp, t->time_start);
+  res = tmp - t->time_start;
   t->time_start = tmp;
 
   return res;
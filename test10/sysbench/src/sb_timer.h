@@ -74,6 +74,67 @@
   } while (0)
 #endif
 
+/* Timer sources, selected with --timer */
+#define SB_TIMER_SOURCE_MONOTONIC 0
+#define SB_TIMER_SOURCE_TSC       1
+
+/* The cycle counter is read directly on x86-64 (TSC) and arm64 (CNTVCT) */
+#if (defined(__x86_64__) || defined(__aarch64__)) && defined(__SIZEOF_INT128__)
+# define SB_HAVE_TSC 1
+#endif
+
+/*
+  Clock behind all timers. With the TSC source, timestamps are
+  ns_base + (counter - tsc_base) * mult / 2^32, where the counter frequency
+  is calibrated against CLOCK_MONOTONIC once at startup, so that timestamps
+  stay in nanoseconds on the CLOCK_MONOTONIC time line. Written before any
+  threads are started and read-only afterwards.
+*/
+typedef struct
+{
+  int      source;
+  uint64_t tsc_base;
+  uint64_t ns_base;
+  uint64_t mult;                /* nanoseconds per tick, 32.32 fixed point */
+  double   tsc_mhz;
+} sb_timer_clock_t;
+
+extern sb_timer_clock_t sb_timer_clock;
+
+#ifdef SB_HAVE_TSC
+static inline uint64_t sb_tsc_read(void)
+{
+# if defined(__x86_64__)
+  uint32_t lo, hi;
+
+  /* lfence keeps rdtsc from executing ahead of earlier instructions */
+  __asm__ __volatile__("lfence; rdtsc" : "=a" (lo), "=d" (hi) : : "memory");
+  return ((uint64_t) hi << 32) | lo;
+# else
+  uint64_t v;
+
+  __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r" (v) : : "memory");
+  return v;
+# endif
+}
+#endif
+
+/* Current time in nanoseconds from the selected timer source */
+static inline uint64_t sb_timer_now(void)
+{
+#ifdef SB_HAVE_TSC
+  if (sb_timer_clock.source == SB_TIMER_SOURCE_TSC)
+    return sb_timer_clock.ns_base +
+      (uint64_t) (((unsigned __int128) (sb_tsc_read() - sb_timer_clock.tsc_base) *
+                   sb_timer_clock.mult) >> 32);
+#endif
+
+  struct timespec ts;
+
+  SB_GETTIME(&ts);
+  return SEC2NS(ts.tv_sec) + ts.tv_nsec;
+}
+
 typedef enum {TIMER_UNINITIALIZED, TIMER_INITIALIZED, TIMER_STOPPED, \
               TIMER_RUNNING} timer_state_t;
 
@@ -81,8 +142,8 @@ typedef enum {TIMER_UNINITIALIZED, TIMER_INITIALIZED, TIMER_STOPPED, \
 
 typedef struct
 {
-  struct timespec time_start;
-  struct timespec time_end;
+  uint64_t        time_start;   /* sb_timer_now() timestamps */
+  uint64_t        time_end;
   uint64_t        events;
   uint64_t        queue_time;
   uint64_t        min_time;
@@ -91,8 +152,7 @@ typedef struct
 
   ck_spinlock_t   lock;
 
-  char pad[SB_CACHELINE_PAD(sizeof(struct timespec)*2 + sizeof(uint64_t)*5 +
-                            sizeof(ck_spinlock_t))];
+  char pad[SB_CACHELINE_PAD(sizeof(uint64_t)*7 + sizeof(ck_spinlock_t))];
 } sb_timer_t;
 
 
@@ -102,6 +162,16 @@ static inline int sb_nanosleep(uint64_t ns)
   return nanosleep(&ts, NULL);
 }
 
+/*
+  Select the timer source by name ("monotonic" or "tsc"). Falls back to
+  CLOCK_MONOTONIC with a warning when no invariant cycle counter is available.
+  Returns 1 for an unknown name. Must be called before any timer is started.
+*/
+int sb_timer_set_source(const char *name);
+
+/* Name of the timer source in use */
+const char *sb_timer_source_name(void);
+
 /* timer control functions */
 
 /* Initialize timer */
@@ -118,7 +188,7 @@ static inline void sb_timer_start(sb_timer_t *t)
 {
   ck_spinlock_lock(&t->lock);
 
-  SB_GETTIME(&t->time_start);
+  t->time_start = sb_timer_now();
 
   ck_spinlock_unlock(&t->lock);
 }
@@ -128,9 +198,9 @@ static inline uint64_t sb_timer_stop(sb_timer_t *t)
 {
   ck_spinlock_lock(&t->lock);
 
-  SB_GETTIME(&t->time_end);
+  t->time_end = sb_timer_now();
 
-  uint64_t elapsed = TIMESPEC_DIFF(t->time_end, t->time_start) + t->queue_time;
+  uint64_t elapsed = t->time_end - t->time_start + t->queue_time;
 
   t->events++;
   t->sum_time += elapsed;
@@ -145,16 +215,39 @@ static inline uint64_t sb_timer_stop(sb_timer_t *t)
   return elapsed;
 }
 
+/*
+  stop timer after n events timed as one unit. Each event is accounted with
+  the amortized latency, which is returned.
+*/
+static inline uint64_t sb_timer_stop_batch(sb_timer_t *t, uint64_t n)
+{
+  ck_spinlock_lock(&t->lock);
+
+  t->time_end = sb_timer_now();
+
+  uint64_t elapsed = t->time_end - t->time_start + t->queue_time;
+  uint64_t per_event = elapsed / n;
+
+  t->events += n;
+  t->sum_time += elapsed;
+
+  if (SB_UNLIKELY(per_event < t->min_time))
+    t->min_time = per_event;
+  if (SB_UNLIKELY(per_event > t->max_time))
+    t->max_time = per_event;
+
+  ck_spinlock_unlock(&t->lock);
+
+  return per_event;
+}
+
 /*
   get the current timer value in nanoseconds without affecting its state, i.e.
   is safe to be used concurrently on a shared timer.
 */
 static inline uint64_t sb_timer_value(sb_timer_t *t)
 {
-  struct timespec ts;
-
-  SB_GETTIME(&ts);
-  return TIMESPEC_DIFF(ts, t->time_start) + t->queue_time;
+  return sb_timer_now() - t->time_start + t->queue_time;
 }
 
 /* Clone a timer */
@@ -82,12 +82,6 @@
 /* Maximum queue length for the tx-rate mode. Must be a power of 2 */
 #define MAX_QUEUE_LEN 131072
 
-/*
-  Extra thread ID assigned to background threads. This may be used as an index
-  into per-thread arrays (see comment in sb_alloc_per_thread_array().
-*/
-#define SB_BACKGROUND_THREAD_ID sb_globals.threads
-
 /* General options */
 sb_arg_t general_args[] =
 {
@@ -103,6 +97,12 @@ sb_arg_t general_args[] =
   SB_OPT("thread-stack-size", "size of stack per thread", "64K", SIZE),
   SB_OPT("thread-init-timeout", "wait time in seconds for worker threads to initialize", "30", INT),
   SB_OPT("rate", "average transactions rate. 0 for unlimited rate", "0", INT),
+  SB_OPT("rate-response-time", "with --rate, report response times measured "
+         "from the scheduled start of each event, including the time it waited "
+         "for a free thread, separately from service times", "off", BOOL),
+  SB_OPT("events-per-batch", "number of events the default event loop "
+         "executes back to back and times as one unit. Each event is "
+         "accounted with the amortized latency", "1", INT),
   SB_OPT("report-interval", "periodically report intermediate statistics with "
          "a specified interval in seconds. 0 disables intermediate reports",
          "0", INT),
@@ -111,6 +111,10 @@ sb_arg_t general_args[] =
          "values representing the amount of time in seconds elapsed from start "
          "of test when report checkpoint(s) must be performed. Report "
          "checkpoints are off by default.", "", LIST),
+  SB_OPT("timer", "clock source for event timing and reports {monotonic,tsc}. "
+         "tsc reads the CPU cycle counter calibrated against "
+         "CLOCK_MONOTONIC, falling back to monotonic when it is not "
+         "invariant", "monotonic", STRING),
   SB_OPT("debug", "print more debugging info", "off", BOOL),
   SB_OPT("validate", "perform validation checks where possible", "off", BOOL),
   SB_OPT("help", "print help and exit", "off", BOOL),
@@ -149,6 +153,48 @@ static ck_ring_t          queue_ring CK_CC_CACHELINE;
 static int report_thread_created CK_CC_CACHELINE;
 static int checkpoints_thread_created;
 static int eventgen_thread_created;
+static int stop_thread_created;
+
+/*
+  Per-thread share of the --events budget. Workers take events from their own
+  quota and only touch the shared sb_globals.nevents counter to grab another
+  chunk of event_chunk events when it runs out.
+*/
+typedef struct
+{
+  uint64_t left;
+  char     pad[SB_CACHELINE_PAD(sizeof(uint64_t))];
+} sb_event_quota_t;
+
+static sb_event_quota_t *event_quotas;
+static uint64_t         event_chunk;
+
+/*
+  Scheduled start time of the event each thread is executing, for response
+  times with --rate-response-time
+*/
+typedef struct
+{
+  uint64_t intended_ns;
+  char     pad[SB_CACHELINE_PAD(sizeof(uint64_t))];
+} sb_event_sched_t;
+
+static sb_event_sched_t *event_sched;
+
+/* Percentiles in service and response time reports */
+const double sb_report_pcts[SB_REPORT_NPCTS] =
+  { 50, 90, 99, 99.9, 99.99, 100 };
+const char *sb_report_pct_names[SB_REPORT_NPCTS] =
+  { "p50", "p90", "p99", "p99.9", "p99.99", "max" };
+
+/* Upper bound on event_chunk, limits the imbalance at the end of a run */
+#define SB_EVENT_CHUNK_MAX 1024
+
+/*
+  Time before the time limit when workers start reading the clock, covers the
+  wakeup latency of the time limit thread
+*/
+#define SB_STOP_NEAR_NS 10000000
 
 /* per-thread timers for response time stats */
 static sb_timer_t *timers;
@@ -192,7 +238,13 @@ void sb_report_intermediate(sb_stat_t *stat)
                 stat->events / stat->time_interval,
                 sb_globals.percentile,
                 SEC2MS(stat->latency_pct));
-  if (sb_globals.tx_rate > 0)
+  if (sb_globals.response_time)
+    log_timestamp(LOG_NOTICE, stat->time_total,
+                  "queue length: %" PRIu64 " concurrency: %" PRIu64
+                  " resp (ms,%u%%): %4.2f",
+                  stat->queue_length, stat->concurrency,
+                  sb_globals.percentile, SEC2MS(stat->response_time_pct));
+  else if (sb_globals.tx_rate > 0)
     log_timestamp(LOG_NOTICE, stat->time_total,
                   "queue length: %" PRIu64 " concurrency: %" PRIu64,
                   stat->queue_length, stat->concurrency);
@@ -238,6 +290,11 @@ static void report_intermediate(void)
     MS2SEC(sb_histogram_get_pct_intermediate(&sb_latency_histogram,
                                              sb_globals.percentile));
 
+  if (sb_globals.response_time)
+    stat.response_time_pct =
+      MS2SEC(sb_histogram_get_pct_intermediate(&sb_response_histogram,
+                                               sb_globals.percentile));
+
   stat.time_interval = NS2SEC(sb_timer_current(&sb_intermediate_timer));
 
   if (sb_globals.tx_rate > 0)
@@ -252,6 +309,16 @@ static void report_intermediate(void)
     sb_report_intermediate(&stat);
 }
 
+/* Print a named percentile value aligned with other latency stats */
+
+static void log_report_pct(const char *name, double value)
+{
+  char label[16];
+
+  snprintf(label, sizeof(label), "%s:", name);
+  log_text(LOG_NOTICE, "         %-8s %35.2f", label, SEC2MS(value));
+}
+
 /* Default cumulative reports handler */
 
 void sb_report_cumulative(sb_stat_t *stat)
@@ -316,6 +383,22 @@ void sb_report_cumulative(sb_stat_t *stat)
            SEC2MS(stat->latency_sum));
   log_text(LOG_NOTICE, "");
 
+  if (sb_globals.response_time)
+  {
+    log_text(LOG_NOTICE, "Service time percentiles (ms):");
+    for (unsigned i = 0; i < SB_REPORT_NPCTS; i++)
+      log_report_pct(sb_report_pct_names[i], stat->service_time_pcts[i]);
+    log_text(LOG_NOTICE, "");
+
+    log_text(LOG_NOTICE, "Response time percentiles (ms, from scheduled "
+             "start):");
+    log_text(LOG_NOTICE, "        %3dth percentile: %27.2f",
+             sb_globals.percentile, SEC2MS(stat->response_time_pct));
+    for (unsigned i = 0; i < SB_REPORT_NPCTS; i++)
+      log_report_pct(sb_report_pct_names[i], stat->response_time_pcts[i]);
+    log_text(LOG_NOTICE, "");
+  }
+
   /* Aggregate temporary timers copy */
   sb_timer_t t;
   sb_timer_init(&t);
@@ -367,6 +450,28 @@ void sb_report_cumulative(sb_stat_t *stat)
   }
 }
 
+/*
+  Get the --percentile value and the values at sb_report_pcts[] in seconds from
+  a histogram and reset it. Returns the --percentile value.
+*/
+
+static double get_pcts_checkpoint(sb_histogram_t *h, double *pcts)
+{
+  double percentiles[SB_REPORT_NPCTS + 1];
+  double values[SB_REPORT_NPCTS + 1];
+
+  percentiles[0] = sb_globals.percentile;
+  memcpy(percentiles + 1, sb_report_pcts, sizeof(sb_report_pcts));
+
+  sb_histogram_get_pcts_checkpoint(h, SB_REPORT_NPCTS + 1, percentiles,
+                                   values);
+
+  for (unsigned i = 0; i < SB_REPORT_NPCTS; i++)
+    pcts[i] = MS2SEC(values[i + 1]);
+
+  return MS2SEC(values[0]);
+}
+
 /* Do a checkpoint, i.e. aggregate and reset collected statistics */
 
 static void checkpoint(sb_stat_t *stat)
@@ -378,9 +483,17 @@ static void checkpoint(sb_stat_t *stat)
 
   stat->time_interval = NS2SEC(sb_timer_current(&sb_checkpoint_timer));
 
-  stat->latency_pct =
-    MS2SEC(sb_histogram_get_pct_checkpoint(&sb_latency_histogram,
-                                           sb_globals.percentile));
+  if (sb_globals.response_time)
+  {
+    stat->latency_pct = get_pcts_checkpoint(&sb_latency_histogram,
+                                            stat->service_time_pcts);
+    stat->response_time_pct = get_pcts_checkpoint(&sb_response_histogram,
+                                                  stat->response_time_pcts);
+  }
+  else
+    stat->latency_pct =
+      MS2SEC(sb_histogram_get_pct_checkpoint(&sb_latency_histogram,
+                                             sb_globals.percentile));
 
   /* Atomically reset each timer after copying it into its timers_copy slot */
   for (size_t i = 0; i < sb_globals.threads; i++)
@@ -622,10 +735,28 @@ void print_run_mode(sb_test_t *test)
   if (sb_globals.warmup_time > 0)
     log_text(LOG_NOTICE, "Warmup time: %ds", sb_globals.warmup_time);
 
+  if (sb_timer_clock.source == SB_TIMER_SOURCE_TSC)
+    log_text(LOG_NOTICE, "Timer: %s (%.1f MHz, calibrated against "
+             "CLOCK_MONOTONIC)", sb_timer_source_name(),
+             sb_timer_clock.tsc_mhz);
+
   if (sb_globals.tx_rate > 0)
   {
     log_text(LOG_NOTICE,
             "Target transaction rate: %d/sec", sb_globals.tx_rate);
+    if (sb_globals.response_time)
+      log_text(LOG_NOTICE, "Response times are measured from scheduled "
+               "event start times");
+  }
+
+  if (sb_globals.events_per_batch > 1)
+  {
+    if (test->ops.thread_run != NULL)
+      log_text(LOG_WARNING, "--events-per-batch is ignored, this test runs "
+               "its own event loop");
+    else
+      log_text(LOG_NOTICE, "Events per batch: %u (amortized latency)",
+               sb_globals.events_per_batch);
   }
 
   if (sb_globals.report_interval)
@@ -685,30 +816,64 @@ void print_run_mode(sb_test_t *test)
     test->ops.print_mode();
 }
 
-bool sb_more_events(int thread_id)
+/*
+  Check whether the time limit has been reached. Only reads the stop flag
+  raised by stop_thread_proc() until the limit is close.
+*/
+static inline bool sb_time_limit_reached(void)
 {
-  (void) thread_id; /* unused */
+  const int stop = ck_pr_load_int(&sb_globals.stop);
 
-  if (sb_globals.error)
+  if (SB_LIKELY(stop == SB_STOP_NONE))
     return false;
 
-  /* Check if we have a time limit */
-  if (sb_globals.max_time_ns > 0 &&
-      SB_UNLIKELY(sb_timer_value(&sb_exec_timer) >= sb_globals.max_time_ns))
-  {
-    log_text(LOG_INFO, "Time limit exceeded, exiting...");
-    return false;
-  }
+  return stop == SB_STOP_NOW ||
+    sb_timer_value(&sb_exec_timer) >= sb_globals.max_time_ns;
+}
+
+/*
+  Check the error and stop flags, and reserve up to n events from the thread's
+  quota within the event limit. Returns the number of events reserved, 0 to
+  stop. The time limit is enforced by stop_thread_proc(), so the common case
+  only reads shared flags and thread-local state.
+*/
+static uint64_t sb_reserve_events(int thread_id, uint64_t n)
+{
+  if (SB_UNLIKELY(sb_globals.error || sb_time_limit_reached()))
+    return 0;
 
   /* Check if we have a limit on the number of events */
   const uint64_t max_events = ck_pr_load_64(&sb_globals.max_events);
-  if (max_events > 0 &&
-      SB_UNLIKELY(ck_pr_faa_64(&sb_globals.nevents, 1) >= max_events))
+  if (max_events > 0)
   {
-    log_text(LOG_INFO, "Event limit exceeded, exiting...");
-    return false;
+    sb_event_quota_t * const quota = &event_quotas[thread_id];
+
+    if (SB_UNLIKELY(quota->left == 0))
+    {
+      const uint64_t done = ck_pr_faa_64(&sb_globals.nevents, event_chunk);
+
+      if (SB_UNLIKELY(done >= max_events))
+      {
+        log_text(LOG_INFO, "Event limit exceeded, exiting...");
+        return 0;
+      }
+      quota->left = SB_MIN(event_chunk, max_events - done);
+    }
+
+    if (n > quota->left)
+      n = quota->left;
+    quota->left -= n;
   }
 
+  return n;
+}
+
+
+bool sb_more_events(int thread_id)
+{
+  if (sb_reserve_events(thread_id, 1) == 0)
+    return false;
+
   /* If we are in tx_rate mode, we take events from queue */
   if (sb_globals.tx_rate > 0)
   {
@@ -723,21 +888,21 @@ bool sb_more_events(int thread_id)
 
       /* Re-check for global error and time limit after waiting */
 
-      if (sb_globals.error)
-        return false;
-
-      if (sb_globals.max_time_ns > 0 &&
-          SB_UNLIKELY(sb_timer_value(&sb_exec_timer) >= sb_globals.max_time_ns))
-      {
-        log_text(LOG_INFO, "Time limit exceeded, exiting...");
+      if (sb_globals.error || sb_time_limit_reached())
         return false;
-      }
     }
 
     ck_pr_inc_int(&sb_globals.concurrency);
 
-    timers[thread_id].queue_time = sb_timer_value(&sb_exec_timer) -
-      ((uint64_t *) ptr)[0];
+    /*
+      With --rate-response-time the queue holds scheduled start times, and
+      the time spent in the queue is only accounted in response times.
+    */
+    if (sb_globals.response_time)
+      event_sched[thread_id].intended_ns = ((uint64_t *) ptr)[0];
+    else
+      timers[thread_id].queue_time = sb_timer_value(&sb_exec_timer) -
+        ((uint64_t *) ptr)[0];
   }
 
   return true;
@@ -758,7 +923,17 @@ void sb_event_stop(int thread_id)
   value = sb_timer_stop(timer);
 
   if (sb_globals.percentile > 0)
-    sb_histogram_update(&sb_latency_histogram, NS2MS(value));
+    sb_histogram_update_ns(&sb_latency_histogram, value, 1);
+
+  if (sb_globals.response_time)
+  {
+    /* Completion time relative to sb_exec_timer, same as the schedule */
+    const uint64_t end_ns = timer->time_end - sb_exec_timer.time_start;
+    const uint64_t intended_ns = event_sched[thread_id].intended_ns;
+
+    sb_histogram_update_ns(&sb_response_histogram,
+                           end_ns > intended_ns ? end_ns - intended_ns : 0, 1);
+  }
 
   sb_counter_inc(thread_id, SB_CNT_EVENT);
 
@@ -769,6 +944,56 @@ void sb_event_stop(int thread_id)
 }
 
 
+/* Account for n events timed as one unit by thread_run_batched() */
+
+static void sb_event_stop_batch(int thread_id, uint64_t n)
+{
+  const uint64_t value = sb_timer_stop_batch(&timers[thread_id], n);
+
+  if (sb_globals.percentile > 0)
+    sb_histogram_update_ns(&sb_latency_histogram, value, n);
+
+  sb_counter_add(thread_id, SB_CNT_EVENT, n);
+}
+
+
+/*
+  Event loop for --events-per-batch > 1: the clock reads, the histogram update
+  and the counter update are done once per batch of events.
+*/
+
+static int thread_run_batched(sb_test_t *test, int thread_id)
+{
+  const uint64_t batch = sb_globals.events_per_batch;
+  sb_event_t     event;
+  uint64_t       n, i;
+  int            rc = 0;
+
+  while (rc == 0 && (n = sb_reserve_events(thread_id, batch)) > 0)
+  {
+    sb_event_start(thread_id);
+
+    for (i = 0; i < n && rc == 0; i++)
+    {
+      event = test->ops.next_event(thread_id);
+      if (event.type == SB_REQ_TYPE_NULL)
+        break;
+
+      rc = test->ops.execute_event(&event, thread_id);
+    }
+
+    if (i > 0)
+      sb_event_stop_batch(thread_id, i);
+
+    /* The test ran out of events */
+    if (i < n && rc == 0)
+      break;
+  }
+
+  return rc;
+}
+
+
 /* Main event loop -- the default thread_run implementation */
 
 
@@ -777,6 +1002,9 @@ static int thread_run(sb_test_t *test, int thread_id)
   sb_event_t        event;
   int               rc = 0;
 
+  if (sb_globals.events_per_batch > 1)
+    return thread_run_batched(test, thread_id);
+
   while (sb_more_events(thread_id) && rc == 0)
   {
     event = test->ops.next_event(thread_id);
@@ -907,8 +1135,13 @@ static void *eventgen_thread_proc(void *arg)
     if (next_ns > curr_ns)
       sb_nanosleep(next_ns - curr_ns);
 
-    /* Enqueue a new event */
-    queue_array[i] = sb_timer_value(&sb_exec_timer);
+    /*
+      Enqueue a new event with its enqueue time, or with its scheduled start
+      time for response times, so that any delay in this thread or in the
+      workers is accounted.
+    */
+    queue_array[i] = sb_globals.response_time ? next_ns :
+      sb_timer_value(&sb_exec_timer);
     if (ck_ring_enqueue_spmc(&queue_ring, queue_ring_buffer,
                              &queue_array[i]) == false)
     {
@@ -927,6 +1160,55 @@ static void *eventgen_thread_proc(void *arg)
   return NULL;
 }
 
+/* Sleep until sb_exec_timer reaches a given value */
+
+static void sleep_until(uint64_t ns)
+{
+  uint64_t curr_ns;
+
+  while ((curr_ns = sb_timer_value(&sb_exec_timer)) < ns)
+    sb_nanosleep(ns - curr_ns);
+}
+
+/*
+  Time limit thread: raises the stop flag shortly before the time limit, when
+  worker threads start checking the clock, and once more when it expires. This
+  way workers do not have to read the clock on every event, but still stop at
+  the same point as if they did.
+*/
+
+static void *stop_thread_proc(void *arg)
+{
+  const uint64_t limit_ns = sb_globals.max_time_ns;
+
+  (void)arg; /* unused */
+
+  sb_tls_thread_id = SB_BACKGROUND_THREAD_ID;
+
+  log_text(LOG_DEBUG, "Time limit thread started");
+
+  /* Wait for the worker threads to initialize */
+  if (sb_barrier_wait(&worker_barrier) < 0)
+    return NULL;
+
+  if (limit_ns > SB_STOP_NEAR_NS)
+    sleep_until(limit_ns - SB_STOP_NEAR_NS);
+
+  ck_pr_store_int(&sb_globals.stop, SB_STOP_NEAR);
+
+  sleep_until(limit_ns);
+
+  log_text(LOG_INFO, "Time limit exceeded, exiting...");
+
+  ck_pr_store_int(&sb_globals.stop, SB_STOP_NOW);
+
+  /* Wake up workers waiting for events in the tx_rate mode */
+  if (sb_globals.tx_rate > 0)
+    pthread_cond_broadcast(&queue_cond);
+
+  return NULL;
+}
+
 /* Intermediate reports thread */
 
 static void *report_thread_proc(void *arg)
@@ -1060,6 +1342,7 @@ static int run_test(sb_test_t *test)
   pthread_t    report_thread;
   pthread_t    checkpoints_thread;
   pthread_t    eventgen_thread;
+  pthread_t    stop_thread;
   unsigned int barrier_threads;
   uint64_t     old_max_events = 0;
 
@@ -1085,7 +1368,8 @@ static int run_test(sb_test_t *test)
 
   /* Calculate the required number of threads for the worker start barrier */
   barrier_threads = 1 /* main thread */ + sb_globals.threads +
-    (sb_globals.tx_rate > 0) /* event generation thread */;
+    (sb_globals.tx_rate > 0) /* event generation thread */ +
+    (sb_globals.max_time_ns > 0) /* time limit thread */;
 
   if (sb_barrier_init(&worker_barrier, barrier_threads,
                       threads_started_callback, NULL))
@@ -1129,6 +1413,19 @@ static int run_test(sb_test_t *test)
     }
   }
 
+  if (sb_globals.max_time_ns > 0)
+  {
+    /* Create a thread to enforce the time limit */
+    if ((err = sb_thread_create(&stop_thread, &sb_thread_attr,
+                                &stop_thread_proc, NULL)) != 0)
+    {
+      log_errno(LOG_FATAL,
+                "sb_thread_create() for the time limit thread failed.");
+      return 1;
+    }
+    stop_thread_created = 1;
+  }
+
   if (sb_globals.n_checkpoints > 0)
   {
     /* Create a thread for checkpoint statistic reports */
@@ -1235,6 +1532,17 @@ static int run_test(sb_test_t *test)
       log_text(LOG_FATAL, "Terminating the event generator thread failed.");
   }
 
+  if (stop_thread_created)
+  {
+    /*
+      The thread has already exited if the time limit was reached, so only
+      failing to join it is an error.
+    */
+    sb_thread_cancel(stop_thread);
+    if (sb_thread_join(stop_thread, NULL))
+      log_errno(LOG_FATAL, "Terminating the time limit thread failed.");
+  }
+
   if (checkpoints_thread_created)
   {
     if (sb_thread_cancel(checkpoints_thread) ||
@@ -1361,6 +1669,13 @@ static int init(void)
       sb_globals.force_shutdown = 0;
   }
 
+  tmp = sb_get_value_string("timer");
+  if (sb_timer_set_source(tmp))
+  {
+    log_text(LOG_FATAL, "Invalid value for --timer: '%s'", tmp);
+    return 1;
+  }
+
   int err;
   if ((err = sb_thread_init()))
     return err;
@@ -1383,6 +1698,27 @@ static int init(void)
 
   sb_globals.tx_rate = sb_get_value_int("rate");
 
+  if (sb_get_value_int("events-per-batch") < 1)
+  {
+    log_text(LOG_FATAL, "Invalid value for --events-per-batch: %d.\n",
+             sb_get_value_int("events-per-batch"));
+    return 1;
+  }
+  sb_globals.events_per_batch = sb_get_value_int("events-per-batch");
+  sb_globals.response_time = sb_get_value_flag("rate-response-time");
+  if (sb_globals.response_time && sb_globals.tx_rate == 0)
+  {
+    log_text(LOG_FATAL, "--rate-response-time requires --rate");
+    return 1;
+  }
+
+  if (sb_globals.events_per_batch > 1 && sb_globals.tx_rate > 0)
+  {
+    log_text(LOG_FATAL, "--events-per-batch cannot be used with --rate, "
+             "events are queued and timed one by one.\n");
+    return 1;
+  }
+
   sb_globals.report_interval = sb_get_value_int("report-interval");
 
   sb_globals.n_checkpoints = 0;
@@ -1428,6 +1764,27 @@ static int init(void)
   for (unsigned i = 0; i < sb_globals.threads; i++)
     sb_timer_init(&timers[i]);
 
+  event_quotas = sb_alloc_per_thread_array(sizeof(sb_event_quota_t));
+  event_sched = sb_alloc_per_thread_array(sizeof(sb_event_sched_t));
+
+  if (event_quotas == NULL || event_sched == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    return 1;
+  }
+
+  /*
+    Hand out the event budget in chunks of about 1/16th of each thread's fair
+    share, rounded up to a whole number of batches.
+  */
+  event_chunk = sb_globals.max_events / (16 * (uint64_t) sb_globals.threads);
+  if (event_chunk > SB_EVENT_CHUNK_MAX)
+    event_chunk = SB_EVENT_CHUNK_MAX;
+  else if (event_chunk == 0)
+    event_chunk = 1;
+  event_chunk = (event_chunk + sb_globals.events_per_batch - 1) /
+    sb_globals.events_per_batch * sb_globals.events_per_batch;
+
   /* LuaJIT commands */
   sb_globals.luajit_cmd = sb_get_value_string("luajit-cmd");
 
@@ -85,6 +85,15 @@ typedef struct
 
 /* Statistics */
 
+/*
+  Number of percentiles in sb_report_pcts[], reported for service and response
+  times with --rate-response-time
+*/
+#define SB_REPORT_NPCTS 6
+
+extern const double sb_report_pcts[SB_REPORT_NPCTS];
+extern const char *sb_report_pct_names[SB_REPORT_NPCTS];
+
 typedef struct {
   uint32_t threads_running;     /* Number of active threads */
 
@@ -92,12 +101,21 @@ typedef struct {
   double   time_total;          /* Time elapsed since the benchmark start */
 
   double   latency_pct;         /* Latency percentile */
+  double   response_time_pct;   /* Response time percentile
+                                   (--rate-response-time only) */
 
   double   latency_min;         /* Minimum latency (cumulative reports only) */
   double   latency_max;         /* Maximum latency (cumulative reports only) */
   double   latency_avg;         /* Average latency (cumulative reports only) */
   double   latency_sum;         /* Sum latency (cumulative reports only) */
 
+  /*
+    Service and response time values at sb_report_pcts[] (cumulative reports
+    with --rate-response-time only)
+  */
+  double   service_time_pcts[SB_REPORT_NPCTS];
+  double   response_time_pcts[SB_REPORT_NPCTS];
+
   uint64_t events;              /* Number of executed events */
   uint64_t reads;               /* Number of read operations */
   uint64_t writes;              /* Number of write operations */
@@ -175,14 +193,28 @@ typedef struct sb_test
   sb_list_item_t    listitem;
 } sb_test_t;
 
+/*
+  Values of sb_globals.stop. Workers only read the clock to check the time
+  limit once it is close, i.e. in the SB_STOP_NEAR state.
+*/
+typedef enum
+{
+  SB_STOP_NONE,
+  SB_STOP_NEAR,
+  SB_STOP_NOW
+} sb_stop_t;
+
 /* sysbench global variables */
 
 typedef struct
 {
   int             error CK_CC_CACHELINE;        /* global error flag */
+  int             stop;         /* time limit state, see sb_stop_t */
   int             argc;         /* command line arguments count */
   char            **argv;      /* command line arguments */
   unsigned int    tx_rate;      /* target transaction rate */
+  unsigned char   response_time; /* record --rate response times */
+  unsigned int    events_per_batch; /* events timed as one unit */
   uint64_t        max_events;   /* maximum number of events to execute */
   uint64_t        max_time_ns;  /* total execution time limit */
   pthread_mutex_t exec_mutex CK_CC_CACHELINE;   /* execution mutex */
@@ -222,6 +254,12 @@ extern sb_timer_t      sb_checkpoint_timer;
 
 extern TLS int sb_tls_thread_id;
 
+/*
+  Extra thread ID assigned to background threads. This may be used as an index
+  into per-thread arrays (see comment in sb_alloc_per_thread_array().
+*/
+#define SB_BACKGROUND_THREAD_ID sb_globals.threads
+
 bool sb_more_events(int thread_id);
 sb_event_t sb_next_event(sb_test_t *test, int thread_id);
 void sb_event_start(int thread_id);
@@ -6,6 +6,17 @@
 #include <unistd.h>
 #include <sys/syscall.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <math.h>
 
 /* Syscall numbers - adjust these based on your kernel implementation */
 #define SYS_enable_pte_meta  469
@@ -21,21 +32,880 @@ struct metadata_header {
     uint32_t reserved;
 };
 
+/*
+ * Backends. The kernel backend issues the real syscalls. The emulation
+ * backend keeps a per-process shadow table in userspace and reproduces the
+ * kernel's errno contract, so the suite also runs on stock kernels.
+ */
+#define PTE_META_BACKEND_KERNEL 0
+#define PTE_META_BACKEND_EMUL   1
+
+/* Consulted on first use when no backend has been selected explicitly */
+#define PTE_META_BACKEND_ENV "PTE_META_BACKEND"
+
+/* Page table geometry mirrored by the emulation (4KiB pages, 2MiB PMDs) */
+#define PTE_META_PAGE_SHIFT   12
+#define PTE_META_PMD_SHIFT    21
+#define PTE_META_PTRS_PER_PTE (1UL << (PTE_META_PMD_SHIFT - PTE_META_PAGE_SHIFT))
+#define PTE_META_PMD_SIZE     (1UL << PTE_META_PMD_SHIFT)
+
+/* Largest MDP=1 payload accepted by the emulation */
+#define PTE_META_EMUL_MAX_PAYLOAD 4096
+
+/* Number of hash buckets in the emulation shadow table */
+#define PTE_META_EMUL_BUCKETS 4096
+
+/*
+ * Emulated expanded PTE page: the metadata half the kernel appends to the
+ * 512 PTEs when it grows a page table page from 4KiB to 8KiB. MDP=1 slots
+ * keep a private copy of the caller's header + payload in ext[].
+ */
+struct pte_meta_emul_pmd {
+    unsigned long pmd;
+    struct pte_meta_emul_pmd *next;
+    uint64_t meta[PTE_META_PTRS_PER_PTE];
+    void *ext[PTE_META_PTRS_PER_PTE];
+};
+
+/*
+ * Shadow table bucket. Each bucket has its own lock so that, like the
+ * kernel's split PMD page table locks, only calls hitting the same PMD (or a
+ * PMD hashing to the same bucket) contend with each other.
+ */
+struct pte_meta_emul_bucket {
+    pthread_mutex_t lock;
+    struct pte_meta_emul_pmd *head;
+} __attribute__((aligned(64)));
+
+/*
+ * Backend and shadow table state. The table is private to the translation
+ * unit including this header, which is one per benchmark program.
+ */
+static int pte_meta_backend = -1;
+static struct pte_meta_emul_bucket pte_meta_emul_table[PTE_META_EMUL_BUCKETS] = {
+    [0 ... PTE_META_EMUL_BUCKETS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+static unsigned long pte_meta_emul_nr_expanded;
+
+/* Parse a backend name, returns -1 for unknown names */
+static inline int pte_meta_parse_backend(const char *name) {
+    if (!strcasecmp(name, "kernel"))
+        return PTE_META_BACKEND_KERNEL;
+    if (!strcasecmp(name, "emul"))
+        return PTE_META_BACKEND_EMUL;
+    return -1;
+}
+
+static inline const char *pte_meta_backend_name(int backend) {
+    return backend == PTE_META_BACKEND_EMUL ? "emul" : "kernel";
+}
+
+static inline void pte_meta_set_backend(int backend) {
+    pte_meta_backend = backend;
+}
+
+static inline int pte_meta_get_backend(void) {
+    if (pte_meta_backend < 0) {
+        const char *s = getenv(PTE_META_BACKEND_ENV);
+        int backend = PTE_META_BACKEND_KERNEL;
+
+        if (s != NULL && *s != '\0' && (backend = pte_meta_parse_backend(s)) < 0) {
+            fprintf(stderr, "%s: unknown backend '%s', using 'kernel'\n",
+                    PTE_META_BACKEND_ENV, s);
+            backend = PTE_META_BACKEND_KERNEL;
+        }
+        pte_meta_backend = backend;
+    }
+    return pte_meta_backend;
+}
+
+/* Number of PTE pages currently expanded to 8KiB by the emulation */
+static inline unsigned long pte_meta_emul_expanded(void) {
+    return __atomic_load_n(&pte_meta_emul_nr_expanded, __ATOMIC_RELAXED);
+}
+
+/* Lock and return the shadow table bucket holding a PMD */
+static inline struct pte_meta_emul_bucket *pte_meta_emul_lock(unsigned long pmd) {
+    struct pte_meta_emul_bucket *b =
+        &pte_meta_emul_table[pmd & (PTE_META_EMUL_BUCKETS - 1)];
+
+    pthread_mutex_lock(&b->lock);
+    return b;
+}
+
+/* Shadow table helpers, called with the bucket lock held */
+
+static inline struct pte_meta_emul_pmd **pte_meta_emul_slot(struct pte_meta_emul_bucket *b,
+                                                          unsigned long pmd) {
+    struct pte_meta_emul_pmd **p = &b->head;
+
+    while (*p != NULL && (*p)->pmd != pmd)
+        p = &(*p)->next;
+    return p;
+}
+
+static inline struct pte_meta_emul_pmd *pte_meta_emul_expand(struct pte_meta_emul_pmd **slot,
+                                                            unsigned long pmd) {
+    struct pte_meta_emul_pmd *e = calloc(1, sizeof(*e));
+
+    if (e == NULL)
+        return NULL;
+    e->pmd = pmd;
+    *slot = e;
+    __atomic_add_fetch(&pte_meta_emul_nr_expanded, 1, __ATOMIC_RELAXED);
+    return e;
+}
+
+static inline int pte_meta_emul_fail(struct pte_meta_emul_bucket *b, int err) {
+    pthread_mutex_unlock(&b->lock);
+    errno = err;
+    return -1;
+}
+
+/* Emulated syscalls, same return value and errno contract as the kernel */
+
+static inline int pte_meta_emul_enable(unsigned long addr) {
+    unsigned long pmd = addr >> PTE_META_PMD_SHIFT;
+    struct pte_meta_emul_bucket *b = pte_meta_emul_lock(pmd);
+    struct pte_meta_emul_pmd **slot = pte_meta_emul_slot(b, pmd);
+
+    if (*slot != NULL)
+        return pte_meta_emul_fail(b, EEXIST);
+    if (pte_meta_emul_expand(slot, pmd) == NULL)
+        return pte_meta_emul_fail(b, ENOMEM);
+    pthread_mutex_unlock(&b->lock);
+    return 0;
+}
+
+static inline int pte_meta_emul_disable(unsigned long addr) {
+    unsigned long pmd = addr >> PTE_META_PMD_SHIFT;
+    struct pte_meta_emul_bucket *b = pte_meta_emul_lock(pmd);
+    struct pte_meta_emul_pmd **slot = pte_meta_emul_slot(b, pmd), *e;
+
+    if ((e = *slot) == NULL)
+        return pte_meta_emul_fail(b, EINVAL);
+    *slot = e->next;
+    __atomic_sub_fetch(&pte_meta_emul_nr_expanded, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&b->lock);
+
+    /* Collapsing the PTE page drops all metadata stored in it */
+    for (unsigned long i = 0; i < PTE_META_PTRS_PER_PTE; i++)
+        free(e->ext[i]);
+    free(e);
+    return 0;
+}
+
+static inline int pte_meta_emul_set(unsigned long addr, int mdp, unsigned long meta_ptr) {
+    unsigned long pmd = addr >> PTE_META_PMD_SHIFT;
+    unsigned long idx = (addr >> PTE_META_PAGE_SHIFT) & (PTE_META_PTRS_PER_PTE - 1);
+    const struct metadata_header *hdr = (const struct metadata_header *)meta_ptr;
+    struct pte_meta_emul_bucket *b;
+    struct pte_meta_emul_pmd **slot, *e;
+    size_t size = 0;
+
+    if (mdp != 0 && mdp != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (meta_ptr == 0) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (mdp == 1) {
+        if (hdr->length > PTE_META_EMUL_MAX_PAYLOAD) {
+            errno = EINVAL;
+            return -1;
+        }
+        size = sizeof(*hdr) + hdr->length;
+    }
+
+    b = pte_meta_emul_lock(pmd);
+    slot = pte_meta_emul_slot(b, pmd);
+    /* Like the kernel, the first set expands the PTE page on demand */
+    if ((e = *slot) == NULL && (e = pte_meta_emul_expand(slot, pmd)) == NULL)
+        return pte_meta_emul_fail(b, ENOMEM);
+
+    if (mdp == 0) {
+        free(e->ext[idx]);
+        e->ext[idx] = NULL;
+        e->meta[idx] = *(const uint64_t *)meta_ptr;
+    } else {
+        const struct metadata_header *old = e->ext[idx];
+
+        /* Rewrite same-sized records in place to keep the hot path cheap */
+        if (old == NULL || old->length != hdr->length) {
+            void *copy = malloc(size);
+
+            if (copy == NULL)
+                return pte_meta_emul_fail(b, ENOMEM);
+            free(e->ext[idx]);
+            e->ext[idx] = copy;
+        }
+        memcpy(e->ext[idx], hdr, size);
+        e->meta[idx] = 0;
+    }
+    pthread_mutex_unlock(&b->lock);
+    return 0;
+}
+
+static inline int pte_meta_emul_get(unsigned long addr, void *buffer) {
+    unsigned long pmd = addr >> PTE_META_PMD_SHIFT;
+    unsigned long idx = (addr >> PTE_META_PAGE_SHIFT) & (PTE_META_PTRS_PER_PTE - 1);
+    struct pte_meta_emul_bucket *b;
+    struct pte_meta_emul_pmd *e;
+    const void *src;
+    size_t size;
+
+    if (buffer == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    b = pte_meta_emul_lock(pmd);
+    if ((e = *pte_meta_emul_slot(b, pmd)) == NULL)
+        return pte_meta_emul_fail(b, ENODATA);
+
+    if (e->ext[idx] != NULL) {
+        src = e->ext[idx];
+        size = sizeof(struct metadata_header) +
+            ((const struct metadata_header *)src)->length;
+    } else {
+        src = &e->meta[idx];
+        size = sizeof(e->meta[idx]);
+    }
+    memcpy(buffer, src, size);
+    pthread_mutex_unlock(&b->lock);
+    return 0;
+}
+
 /* Syscall wrappers aligned with new design */
 static inline int enable_pte_meta(unsigned long addr) {
+    if (pte_meta_get_backend() == PTE_META_BACKEND_EMUL)
+        return pte_meta_emul_enable(addr);
     return syscall(SYS_enable_pte_meta, addr);
 }
 
 static inline int disable_pte_meta(unsigned long addr) {
+    if (pte_meta_get_backend() == PTE_META_BACKEND_EMUL)
+        return pte_meta_emul_disable(addr);
     return syscall(SYS_disable_pte_meta, addr);
 }
 
 static inline int set_pte_meta(unsigned long addr, int mdp, unsigned long meta_ptr) {
+    if (pte_meta_get_backend() == PTE_META_BACKEND_EMUL)
+        return pte_meta_emul_set(addr, mdp, meta_ptr);
     return syscall(SYS_set_pte_meta, addr, mdp, meta_ptr);
 }
 
 static inline int get_pte_meta(unsigned long addr, void *buffer) {
+    if (pte_meta_get_backend() == PTE_META_BACKEND_EMUL)
+        return pte_meta_emul_get(addr, buffer);
     return syscall(SYS_get_pte_meta, addr, buffer);
 }
 
-#endif /* PTE_META_SYSCALLS_H */
\ No newline at end of file
+/*
+ * Generic entry point for callers that pass syscall numbers around (the
+ * standalone tests' call_or_die helpers). Routes the four PTE metadata
+ * syscalls through the selected backend.
+ */
+static inline long pte_meta_syscall(long nr, unsigned long a1,
+                                    unsigned long a2, unsigned long a3) {
+    switch (nr) {
+    case SYS_enable_pte_meta:
+        return enable_pte_meta(a1);
+    case SYS_disable_pte_meta:
+        return disable_pte_meta(a1);
+    case SYS_set_pte_meta:
+        return set_pte_meta(a1, (int)a2, a3);
+    case SYS_get_pte_meta:
+        return get_pte_meta(a1, (void *)a2);
+    default:
+        return syscall(nr, a1, a2, a3);
+    }
+}
+
+/*
+ * Vectored set/get. Each entry names one page; for sets, MDP=0 entries carry
+ * the value inline and MDP=1 entries point to a header + payload record, for
+ * gets ptr is the destination buffer. Entries are sorted by page in place,
+ * and redundant entries for the same page are folded: only the last set is
+ * submitted, and a single get result is copied to every duplicate.
+ *
+ * Both return the number of backend calls issued. The per-entry outcome is
+ * left in err (0 or an errno value).
+ */
+struct pte_meta_vec {
+    unsigned long addr;
+    int mdp;
+    int err;
+    union {
+        uint64_t value;      /* set, MDP=0 */
+        void *ptr;           /* set, MDP=1 record; get, result buffer */
+    };
+};
+
+/* Batches up to this size are insertion sorted, larger ones go to qsort() */
+#define PTE_META_VEC_ISORT_MAX 256
+
+/* qsort() order: page number, then original position kept in err */
+static inline int pte_meta_vec_cmp(const void *a, const void *b) {
+    const struct pte_meta_vec *x = a, *y = b;
+    const unsigned long px = x->addr >> PTE_META_PAGE_SHIFT;
+    const unsigned long py = y->addr >> PTE_META_PAGE_SHIFT;
+
+    if (px != py)
+        return px < py ? -1 : 1;
+    return (x->err > y->err) - (x->err < y->err);
+}
+
+/*
+ * Stable in-place sort by page number. Batches are usually small and close
+ * to sorted already (sequential access), where insertion sort beats qsort().
+ * Larger batches use qsort() to avoid the quadratic worst case, with err
+ * holding each entry's position as a tie-break; every entry's err is
+ * rewritten after the sort anyway.
+ */
+static inline void pte_meta_vec_sort(struct pte_meta_vec *vec, size_t n) {
+    if (n > PTE_META_VEC_ISORT_MAX) {
+        for (size_t i = 0; i < n; i++)
+            vec[i].err = (int)i;
+        qsort(vec, n, sizeof(*vec), pte_meta_vec_cmp);
+        return;
+    }
+
+    for (size_t i = 1; i < n; i++) {
+        struct pte_meta_vec e = vec[i];
+        unsigned long page = e.addr >> PTE_META_PAGE_SHIFT;
+        size_t j = i;
+
+        while (j > 0 && (vec[j - 1].addr >> PTE_META_PAGE_SHIFT) > page) {
+            vec[j] = vec[j - 1];
+            j--;
+        }
+        vec[j] = e;
+    }
+}
+
+/*
+ * Single submission point for a sorted, deduplicated run of entries. This is
+ * a loop over the per-page syscalls today, a batched kernel call can replace
+ * it without touching the callers.
+ */
+static inline size_t pte_meta_submit(int set, struct pte_meta_vec **run, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        struct pte_meta_vec *e = run[i];
+        int ret;
+
+        if (set)
+            ret = set_pte_meta(e->addr, e->mdp, e->mdp == 0 ?
+                               (unsigned long)&e->value : (unsigned long)e->ptr);
+        else
+            ret = get_pte_meta(e->addr, e->ptr);
+        e->err = ret == 0 ? 0 : errno;
+    }
+    return n;
+}
+
+/* Size of a get result held in buf */
+static inline size_t pte_meta_result_size(int mdp, const void *buf) {
+    if (mdp == 0)
+        return sizeof(uint64_t);
+    return sizeof(struct metadata_header) +
+        ((const struct metadata_header *)buf)->length;
+}
+
+/* Largest number of entries passed to pte_meta_submit() at once */
+#define PTE_META_VEC_RUN 64
+
+static inline int pte_meta_vec_do(int set, struct pte_meta_vec *vec, size_t n) {
+    struct pte_meta_vec *run[PTE_META_VEC_RUN];
+    size_t nrun = 0, calls = 0, i = 0;
+
+    pte_meta_vec_sort(vec, n);
+
+    while (i < n) {
+        unsigned long page = vec[i].addr >> PTE_META_PAGE_SHIFT;
+        size_t end = i + 1;
+
+        while (end < n && (vec[end].addr >> PTE_META_PAGE_SHIFT) == page)
+            end++;
+
+        /*
+         * The sort is stable, so the last entry of a page is the latest set.
+         * Superseded sets are never submitted and report success, duplicate
+         * gets are marked and filled in once all lookups are done.
+         */
+        const size_t keep = set ? end - 1 : i;
+
+        for (size_t j = i; j < end; j++)
+            if (j != keep)
+                vec[j].err = set ? 0 : -1;
+
+        run[nrun++] = &vec[keep];
+        if (nrun == PTE_META_VEC_RUN || end == n) {
+            calls += pte_meta_submit(set, run, nrun);
+            nrun = 0;
+        }
+        i = end;
+    }
+
+    /* Propagate the single lookup issued per page to its duplicates */
+    if (!set) {
+        for (i = 1; i < n; i++) {
+            const struct pte_meta_vec *src = &vec[i - 1];
+
+            if (vec[i].err != -1)
+                continue;
+            vec[i].err = src->err;
+            if (src->err == 0)
+                memcpy(vec[i].ptr, src->ptr, pte_meta_result_size(src->mdp, src->ptr));
+        }
+    }
+    return (int)calls;
+}
+
+static inline int set_pte_meta_v(struct pte_meta_vec *vec, size_t n) {
+    return pte_meta_vec_do(1, vec, n);
+}
+
+static inline int get_pte_meta_v(struct pte_meta_vec *vec, size_t n) {
+    return pte_meta_vec_do(0, vec, n);
+}
+
+/*
+ * Region-wide lifecycle. The syscalls act on the single PMD containing addr,
+ * so a mapping larger than 2MiB, or one straddling a PMD boundary, has to be
+ * walked PMD by PMD to be fully expanded or collapsed.
+ *
+ * Counts and elapsed time are added to *stats when it is not NULL, so one
+ * structure can accumulate the cost of several regions.
+ */
+struct pte_meta_range_stats {
+    unsigned long pmds;      /* PMDs whose state was changed */
+    unsigned long skipped;   /* PMDs already in the requested state */
+    uint64_t ns;             /* time spent walking the region */
+};
+
+static inline uint64_t pte_meta_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Number of PMDs covering [addr, addr + len) */
+static inline unsigned long pte_meta_range_pmds(unsigned long addr, size_t len) {
+    if (len == 0)
+        return 0;
+    return ((addr + len - 1) >> PTE_META_PMD_SHIFT) - (addr >> PTE_META_PMD_SHIFT) + 1;
+}
+
+/*
+ * Toggle every PMD of [addr, addr + len). PMDs that are already in the target
+ * state (EEXIST on enable, EINVAL on disable) are skipped, e.g. when adjacent
+ * regions share a PMD. Any other failure undoes the PMDs changed by this call
+ * and returns -1 with errno from the failing syscall.
+ */
+static inline int pte_meta_range_toggle(unsigned long addr, size_t len, int enable,
+                                        struct pte_meta_range_stats *stats) {
+    const unsigned long first = addr & ~(PTE_META_PMD_SIZE - 1);
+    const unsigned long nr = pte_meta_range_pmds(addr, len);
+    const int skip_errno = enable ? EEXIST : EINVAL;
+    unsigned long changed = 0, skipped = 0, i;
+    uint64_t start = pte_meta_now_ns();
+    unsigned char *done;
+    int ret = 0;
+
+    /* Remember which PMDs this call changed, only those are undone */
+    if ((done = calloc(nr ? nr : 1, 1)) == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (i = 0; i < nr; i++) {
+        unsigned long pmd = first + i * PTE_META_PMD_SIZE;
+
+        if ((enable ? enable_pte_meta(pmd) : disable_pte_meta(pmd)) == 0) {
+            done[i] = 1;
+            changed++;
+        } else if (errno == skip_errno) {
+            skipped++;
+        } else {
+            ret = -1;
+            break;
+        }
+    }
+
+    if (ret != 0) {
+        int err = errno;
+
+        while (i-- > 0) {
+            unsigned long pmd = first + i * PTE_META_PMD_SIZE;
+
+            if (done[i])
+                (void)(enable ? disable_pte_meta(pmd) : enable_pte_meta(pmd));
+        }
+        changed = 0;
+        errno = err;
+    }
+    free(done);
+
+    if (stats != NULL) {
+        stats->pmds += changed;
+        stats->skipped += skipped;
+        stats->ns += pte_meta_now_ns() - start;
+    }
+    return ret;
+}
+
+static inline int enable_pte_meta_range(unsigned long addr, size_t len,
+                                        struct pte_meta_range_stats *stats) {
+    return pte_meta_range_toggle(addr, len, 1, stats);
+}
+
+static inline int disable_pte_meta_range(unsigned long addr, size_t len,
+                                         struct pte_meta_range_stats *stats) {
+    return pte_meta_range_toggle(addr, len, 0, stats);
+}
+
+/*
+ * Syscall entry baseline. A null syscall (getppid) and a vDSO call
+ * (gettimeofday) are timed the same way the tests time metadata operations,
+ * one clock_gettime() pair per call, so that an op's cost can be reported
+ * net of kernel entry/exit. That part depends on the CPU mitigations in
+ * effect and would otherwise make numbers from different hosts incomparable.
+ */
+struct pte_meta_baseline {
+    int iterations;
+    double syscall_min, syscall_mean;   /* ns, null syscall */
+    double vdso_min, vdso_mean;         /* ns, vDSO call */
+};
+
+static inline void pte_meta_measure_baseline(int iterations,
+                                             struct pte_meta_baseline *b) {
+    double syscall_sum = 0, vdso_sum = 0;
+
+    b->iterations = iterations;
+    b->syscall_min = b->vdso_min = 1e18;
+
+    for (int i = 0; i < iterations; i++) {
+        struct timespec t0, t1;
+        struct timeval tv;
+        double ns;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        syscall(SYS_getppid);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+        syscall_sum += ns;
+        if (ns < b->syscall_min)
+            b->syscall_min = ns;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        gettimeofday(&tv, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+        vdso_sum += ns;
+        if (ns < b->vdso_min)
+            b->vdso_min = ns;
+    }
+
+    b->syscall_mean = iterations > 0 ? syscall_sum / iterations : 0;
+    b->vdso_mean = iterations > 0 ? vdso_sum / iterations : 0;
+}
+
+/*
+ * Cost of an op net of syscall entry. Noise can put a sample below the
+ * baseline, so the result is clamped at zero. Only meaningful for the kernel
+ * backend: emulated ops never enter the kernel.
+ */
+static inline double pte_meta_net_ns(double ns, double entry_ns) {
+    return ns > entry_ns ? ns - entry_ns : 0;
+}
+
+/* Directory listing the state of each known CPU vulnerability */
+#define PTE_META_VULN_DIR "/sys/devices/system/cpu/vulnerabilities"
+
+/*
+ * Print one "name: status" line per CPU vulnerability, sorted by name, each
+ * prefixed with indent. Returns the number of lines printed.
+ */
+static inline int pte_meta_print_mitigations(const char *indent) {
+    char names[64][256];
+    int n = 0;
+    DIR *dir = opendir(PTE_META_VULN_DIR);
+    struct dirent *de;
+
+    if (dir == NULL) {
+        printf("%s(%s not available)\n", indent, PTE_META_VULN_DIR);
+        return 0;
+    }
+    while ((de = readdir(dir)) != NULL && n < 64) {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(names[n], sizeof(names[n]), "%s", de->d_name);
+
+        /* Insertion sort, readdir() order is arbitrary */
+        for (int j = n; j > 0 && strcmp(names[j - 1], names[j]) > 0; j--) {
+            char tmp[256];
+
+            memcpy(tmp, names[j], sizeof(tmp));
+            memcpy(names[j], names[j - 1], sizeof(tmp));
+            memcpy(names[j - 1], tmp, sizeof(tmp));
+        }
+        n++;
+    }
+    closedir(dir);
+
+    for (int i = 0; i < n; i++) {
+        char path[320], label[260], status[256] = "";
+        FILE *fp;
+
+        snprintf(path, sizeof(path), "%s/%s", PTE_META_VULN_DIR, names[i]);
+        if ((fp = fopen(path, "r")) != NULL) {
+            if (fgets(status, sizeof(status), fp) != NULL)
+                status[strcspn(status, "\n")] = '\0';
+            fclose(fp);
+        }
+        snprintf(label, sizeof(label), "%s:", names[i]);
+        printf("%s%-30s %s\n", indent, label, status);
+    }
+    return n;
+}
+
+/*
+ * Cold access. Before a measured op, the page it targets can be pushed out
+ * of the caches and the TLB so that the op pays for the page walk and for
+ * fetching its PTE and metadata from memory:
+ *   clflush   flush the data page's cache lines (x86 and arm64, no-op elsewhere)
+ *   tlb       read one byte per page of a scratch mapping much larger than
+ *             the STLB, which also streams the caches holding the PTE page
+ *   mprotect  toggle the page read-only and back, forcing a TLB shootdown
+ * The PTE page and its metadata half live in kernel memory and cannot be
+ * flushed directly, tlb is the closest approximation.
+ */
+#define PTE_META_EVICT_NONE     0
+#define PTE_META_EVICT_CLFLUSH  1
+#define PTE_META_EVICT_TLB      2
+#define PTE_META_EVICT_MPROTECT 3
+
+/* Scratch mapping walked by the tlb method, 16384 4KiB pages */
+#define PTE_META_EVICT_SCRATCH (64UL << 20)
+
+struct pte_meta_evict {
+    int method;
+    uint8_t *scratch;        /* tlb only */
+    size_t scratch_len;
+};
+
+static inline int pte_meta_parse_evict(const char *name) {
+    if (!strcasecmp(name, "none") || !strcasecmp(name, "off"))
+        return PTE_META_EVICT_NONE;
+    if (!strcasecmp(name, "clflush"))
+        return PTE_META_EVICT_CLFLUSH;
+    if (!strcasecmp(name, "tlb"))
+        return PTE_META_EVICT_TLB;
+    if (!strcasecmp(name, "mprotect"))
+        return PTE_META_EVICT_MPROTECT;
+    return -1;
+}
+
+static inline const char *pte_meta_evict_name(int method) {
+    static const char * const names[] = { "none", "clflush", "tlb", "mprotect" };
+
+    return method >= 0 && method <= PTE_META_EVICT_MPROTECT ? names[method] : "?";
+}
+
+/* Returns 0, or -1 with errno set if the scratch mapping fails */
+static inline int pte_meta_evict_init(struct pte_meta_evict *ev, int method) {
+    ev->method = method;
+    ev->scratch = NULL;
+    ev->scratch_len = 0;
+
+    if (method != PTE_META_EVICT_TLB)
+        return 0;
+
+    ev->scratch = mmap(NULL, PTE_META_EVICT_SCRATCH, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ev->scratch == MAP_FAILED) {
+        ev->scratch = NULL;
+        return -1;
+    }
+#ifdef MADV_NOHUGEPAGE
+    /* One PTE per scratch page, huge pages would need a single TLB entry */
+    madvise(ev->scratch, PTE_META_EVICT_SCRATCH, MADV_NOHUGEPAGE);
+#endif
+    memset(ev->scratch, 1, PTE_META_EVICT_SCRATCH);
+    ev->scratch_len = PTE_META_EVICT_SCRATCH;
+    return 0;
+}
+
+static inline void pte_meta_evict_destroy(struct pte_meta_evict *ev) {
+    if (ev->scratch != NULL)
+        munmap(ev->scratch, ev->scratch_len);
+    ev->scratch = NULL;
+}
+
+/* Evict the page-aligned page of page_size bytes at page */
+static inline void pte_meta_evict(struct pte_meta_evict *ev, void *page,
+                                  size_t page_size) {
+    switch (ev->method) {
+    case PTE_META_EVICT_CLFLUSH:
+        for (size_t off = 0; off < page_size; off += 64) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_clflush((uint8_t *)page + off);
+#elif defined(__aarch64__)
+            __asm__ __volatile__("dc civac, %0" : : "r"((uint8_t *)page + off) : "memory");
+#endif
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_mfence();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("dsb ish" : : : "memory");
+#endif
+        break;
+
+    case PTE_META_EVICT_TLB: {
+        volatile uint8_t *p = ev->scratch;
+        uint8_t sink = 0;
+
+        for (size_t off = 0; off < ev->scratch_len; off += 4096)
+            sink += p[off];
+        (void)sink;
+        break;
+    }
+
+    case PTE_META_EVICT_MPROTECT:
+        mprotect(page, page_size, PROT_READ);
+        mprotect(page, page_size, PROT_READ | PROT_WRITE);
+        break;
+    }
+}
+
+/*
+ * Fixed-memory latency histogram for the standalone timing tests, so that
+ * iteration counts are not bounded by an array of samples. Values (ns) below
+ * 2 * PTE_META_HIST_SUB are counted exactly, above that every power of two
+ * is split into PTE_META_HIST_SUB linear buckets, which bounds the relative
+ * error of a percentile to 1/PTE_META_HIST_SUB. Mean and variance are kept
+ * with Welford's update rather than a sum of squares.
+ */
+#define PTE_META_HIST_SUB_BITS 6
+#define PTE_META_HIST_SUB      (1U << PTE_META_HIST_SUB_BITS)
+#define PTE_META_HIST_MAX_BITS 40        /* values up to 2^40 ns, ~18 minutes */
+#define PTE_META_HIST_BUCKETS  (2 * PTE_META_HIST_SUB + \
+    (PTE_META_HIST_MAX_BITS - PTE_META_HIST_SUB_BITS - 1) * PTE_META_HIST_SUB)
+
+struct pte_meta_hist {
+    uint64_t count;
+    uint64_t min, max;
+    double mean, m2;
+    uint64_t buckets[PTE_META_HIST_BUCKETS];
+};
+
+static inline void pte_meta_hist_init(struct pte_meta_hist *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static inline unsigned pte_meta_hist_index(uint64_t v) {
+    unsigned msb;
+
+    if (v < 2 * PTE_META_HIST_SUB)
+        return (unsigned)v;
+    msb = 63 - __builtin_clzll(v);
+    if (msb >= PTE_META_HIST_MAX_BITS)
+        return PTE_META_HIST_BUCKETS - 1;
+    return 2 * PTE_META_HIST_SUB +
+           (msb - PTE_META_HIST_SUB_BITS - 1) * PTE_META_HIST_SUB +
+           (unsigned)((v >> (msb - PTE_META_HIST_SUB_BITS)) & (PTE_META_HIST_SUB - 1));
+}
+
+/* Smallest value counted in bucket i, and the bucket's width */
+static inline uint64_t pte_meta_hist_low(unsigned i, uint64_t *width) {
+    unsigned shift;
+
+    if (i < 2 * PTE_META_HIST_SUB) {
+        *width = 1;
+        return i;
+    }
+    i -= 2 * PTE_META_HIST_SUB;
+    shift = i / PTE_META_HIST_SUB + 1;
+    *width = 1ULL << shift;
+    return (uint64_t)(PTE_META_HIST_SUB + i % PTE_META_HIST_SUB) << shift;
+}
+
+static inline void pte_meta_hist_record(struct pte_meta_hist *h, uint64_t ns) {
+    double delta = (double)ns - h->mean;
+
+    h->count++;
+    h->mean += delta / h->count;
+    h->m2 += delta * ((double)ns - h->mean);
+    if (ns < h->min)
+        h->min = ns;
+    if (ns > h->max)
+        h->max = ns;
+    h->buckets[pte_meta_hist_index(ns)]++;
+}
+
+static inline double pte_meta_hist_stddev(const struct pte_meta_hist *h) {
+    return h->count > 1 ? sqrt(h->m2 / h->count) : 0;
+}
+
+/* Value at percentile pct (0-100): midpoint of its bucket, within [min, max] */
+static inline uint64_t pte_meta_hist_pct(const struct pte_meta_hist *h, double pct) {
+    uint64_t rank, seen = 0, low, width, v;
+
+    if (h->count == 0)
+        return 0;
+    rank = (uint64_t)(pct / 100.0 * h->count);
+    if (rank >= h->count)
+        rank = h->count - 1;
+    for (unsigned i = 0; i < PTE_META_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank) {
+            low = pte_meta_hist_low(i, &width);
+            v = low + width / 2;
+            return v < h->min ? h->min : v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+/* Percentile table, one "name: value" line per row, each prefixed with indent */
+static inline void pte_meta_hist_print(const struct pte_meta_hist *h,
+                                       const char *indent) {
+    static const double pcts[] = { 50, 90, 99, 99.9, 99.99 };
+    static const char * const names[] = { "p50:", "p90:", "p99:", "p99.9:", "p99.99:" };
+
+    printf("%sMin:     %10llu ns\n", indent, (unsigned long long)h->min);
+    for (int i = 0; i < 5; i++)
+        printf("%s%-8s %10llu ns\n", indent, names[i],
+               (unsigned long long)pte_meta_hist_pct(h, pcts[i]));
+    printf("%sMax:     %10llu ns\n", indent, (unsigned long long)h->max);
+    printf("%sMean:    %10.0f ns\n", indent, h->mean);
+    printf("%sStdDev:  %10.0f ns\n", indent, pte_meta_hist_stddev(h));
+}
+
+/*
+ * Dump the non-empty buckets as CSV rows "label,low_ns,high_ns,count,cum_pct"
+ * for plotting; a header row is written when header is set.
+ */
+static inline void pte_meta_hist_dump(const struct pte_meta_hist *h, FILE *fp,
+                                      const char *label, int header) {
+    uint64_t seen = 0, low, width;
+
+    if (header)
+        fprintf(fp, "series,low_ns,high_ns,count,cum_pct\n");
+    for (unsigned i = 0; i < PTE_META_HIST_BUCKETS; i++) {
+        if (h->buckets[i] == 0)
+            continue;
+        seen += h->buckets[i];
+        low = pte_meta_hist_low(i, &width);
+        fprintf(fp, "%s,%llu,%llu,%llu,%.6f\n", label, (unsigned long long)low,
+                (unsigned long long)(low + width - 1),
+                (unsigned long long)h->buckets[i], 100.0 * seen / h->count);
+    }
+}
+
+#endif /* PTE_META_SYSCALLS_H */
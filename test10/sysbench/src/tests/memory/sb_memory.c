@@ -22,22 +22,39 @@
 
 #include "sysbench.h"
 #include "sb_rand.h"
+#include "sb_histogram.h"
+#include "sb_thread.h"
 #include "pte_meta_syscalls.h"
 
+#include "ck_ring.h"
+
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
 
-#ifdef HAVE_SYS_IPC_H
-# include <sys/ipc.h>
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
 #endif
 
-#ifdef HAVE_SYS_SHM_H
-# include <sys/shm.h>
+#include <inttypes.h>
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+# include <linux/perf_event.h>
+# include <sys/ioctl.h>
 #endif
 
-#include <inttypes.h>
+#ifndef MAP_HUGE_SHIFT
+# define MAP_HUGE_SHIFT 26
+#endif
+
+/* Page backends of the memory buffers */
+#define SB_MEM_PAGE_4K          0
+#define SB_MEM_PAGE_THP_MADVISE 1
+#define SB_MEM_PAGE_THP_ALWAYS  2
+#define SB_MEM_PAGE_HUGETLB_2M  3
+#define SB_MEM_PAGE_HUGETLB_1G  4
+#define SB_MEM_PAGE_BACKENDS    5
 
-#define LARGE_PAGE_SIZE (4UL * 1024 * 1024)
 /* Memory operation types */
 #define SB_MEM_OP_NONE  0
 #define SB_MEM_OP_READ  1
@@ -47,35 +64,131 @@
 #define SB_MEM_SCOPE_GLOBAL 0
 #define SB_MEM_SCOPE_LOCAL  1
 
+/* Access modes of the event kernels */
+#define SB_MEM_ACCESS_SEQ  0
+#define SB_MEM_ACCESS_RND  1  /* random, --rand-type distribution */
+#define SB_MEM_ACCESS_RNDU 2  /* random, uniform distribution inlined */
+
+/* PTE metadata modes of the event kernels */
+#define SB_MEM_META_OFF  0
+#define SB_MEM_META_MDP0 1
+#define SB_MEM_META_MDP1 2
+
+/* Which PTEs the metadata operations of different threads target */
+#define SB_MEM_PTE_SHARE_SCOPE   0  /* follow --memory-scope */
+#define SB_MEM_PTE_SHARE_PRIVATE 1  /* own buffer per thread */
+#define SB_MEM_PTE_SHARE_PAGE    2  /* one hot page for all threads */
+#define SB_MEM_PTE_SHARE_PMD     3  /* own page per thread in one hot PMD */
+#define SB_MEM_PTE_SHARE_REGION  4  /* one buffer shared by all threads */
+#define SB_MEM_PTE_SHARE_MODES   5
+
+/* PTE metadata update granularity */
+#define SB_MEM_PTE_GRAN_WORD  0
+#define SB_MEM_PTE_GRAN_PAGE  1
+#define SB_MEM_PTE_GRAN_EVENT 2
+
+/* Number of preformatted MDP=1 records in each per-thread arena */
+#define SB_MEM_PTE_ARENA_SLOTS 64U
+
+/* Size of the buffer receiving a get_pte_meta result: header + payload */
+#define SB_MEM_PTE_GET_BUF_SIZE (sizeof(struct metadata_header) + 64)
+
+/* Number of entries in each per-thread get_pte_meta read cache */
+#define SB_MEM_PTE_CACHE_SLOTS 256
+
+/* Number of write generation counters, regions are hashed by PMD */
+#define SB_MEM_PTE_GEN_REGIONS 1024
+
+/* Capacity of each worker's asynchronous update ring, must be a power of 2 */
+#define SB_MEM_PTE_RING_SIZE 4096
+
+/* Size and range (in microseconds) of the async latency histograms */
+#define SB_MEM_PTE_HIST_SIZE 1024
+#define SB_MEM_PTE_HIST_MIN  0.001
+#define SB_MEM_PTE_HIST_MAX  1e7
+
+/* MDP=1 header version and type used by the memory test */
+#define SB_MEM_PTE_META_VERSION 1
+#define SB_MEM_PTE_META_TYPE    0x1234
+
+/*
+  Values written with --memory-pte-meta-validate: writer thread id + 1 in the
+  top 16 bits, then the low 24 bits of the page index and of the writer's
+  event number (never 0), so that a written value is never 0.
+*/
+#define SB_MEM_PTE_VAL_BITS 24
+#define SB_MEM_PTE_VAL_MASK ((1U << SB_MEM_PTE_VAL_BITS) - 1)
+#define SB_MEM_PTE_VAL_MAX_THREADS 0xFFFEU
+
+/* Largest number of counters in each worker's --memory-perf-events group */
+#define SB_MEM_PERF_MAX_EVENTS 16
+
 /* Memory test arguments */
 static sb_arg_t memory_args[] =
 {
   SB_OPT("memory-block-size", "size of memory block for test", "1K", SIZE),
   SB_OPT("memory-total-size", "total size of data to transfer", "100G", SIZE),
+  SB_OPT("memory-working-set", "size of the memory region each event selects "
+         "its block from, 0 to use a single block", "0", SIZE),
   SB_OPT("memory-scope", "memory access scope {global,local}", "global",
          STRING),
 #ifdef HAVE_LARGE_PAGES
   SB_OPT("memory-hugetlb", "allocate memory from HugeTLB pool", "off", BOOL),
+  SB_OPT("memory-page-backend", "pages backing the memory buffers "
+         "{4k,thp-madvise,thp-always,hugetlb-2m,hugetlb-1g}", "4k", STRING),
 #endif
   SB_OPT("memory-oper", "type of memory operations {read, write, none}",
          "write", STRING),
   SB_OPT("memory-access-mode", "memory access mode {seq,rnd}", "seq", STRING),
   SB_OPT("memory-pte-meta", "enable PTE metadata syscalls", "off", BOOL),           /* ← ADD HERE */
   SB_OPT("memory-pte-meta-type", "PTE metadata type (0 or 1)", "0", INT),          /* ← ADD HERE */
+  SB_OPT("memory-pte-meta-backend", "PTE metadata backend {kernel,emul}",
+         "kernel", STRING),
+  SB_OPT("memory-pte-meta-granularity", "PTE metadata update granularity: "
+         "every written word, or the final value per page {word,page,event}",
+         "word", STRING),
+  SB_OPT("memory-pte-meta-batch", "number of PTE metadata operations "
+         "submitted at once through the vectored API, 1 to disable batching",
+         "1", INT),
+  SB_OPT("memory-pte-meta-read-cache", "cache get_pte_meta results per "
+         "thread, invalidated by metadata writes", "off", BOOL),
+  SB_OPT("memory-pte-meta-read-cache-sets", "with --memory-pte-meta-read-cache "
+         "and --memory-oper=read, update the metadata of every Nth looked-up "
+         "page before the lookup, invalidating cached reads of its region, 0 "
+         "to disable", "0", INT),
+  SB_OPT("memory-pte-meta-async", "queue metadata updates to dedicated "
+         "drainer threads instead of issuing them inline", "off", BOOL),
+  SB_OPT("memory-pte-meta-async-drainers", "number of drainer threads for "
+         "--memory-pte-meta-async", "1", INT),
+  SB_OPT("memory-pte-meta-sharing", "PTEs targeted by the metadata "
+         "operations of different threads, and per-thread latency reporting "
+         "{scope,private,shared-page,shared-pmd,shared-region}", "scope",
+         STRING),
+  SB_OPT("memory-pte-meta-evict", "evict the target page from the caches "
+         "and the TLB before every other direct metadata operation and report "
+         "cold and warm latency separately {none,clflush,tlb,mprotect}",
+         "none", STRING),
+  SB_OPT("memory-pte-meta-validate", "write deterministic metadata values "
+         "and verify the metadata of every page at the end of the run", "off",
+         BOOL),
+  SB_OPT("memory-pte-meta-validate-threads", "number of verifier threads for "
+         "--memory-pte-meta-validate, 0 to use one per worker thread", "0",
+         INT),
+  SB_OPT("memory-perf-events", "comma-separated list of performance counters "
+         "to collect per worker thread, e.g. cycles,instructions,"
+         "dTLB-load-misses,page-faults or rNNNN for raw events", "", LIST),
 
   SB_OPT_END
 };
 
 /* Memory test operations */
 static int memory_init(void);
+static int memory_thread_init(int);
+static int memory_thread_done(int);
+static int memory_done(void);
 static void memory_print_mode(void);
 static sb_event_t memory_next_event(int);
-static int event_rnd_none(sb_event_t *, int);
-static int event_rnd_read(sb_event_t *, int);
-static int event_rnd_write(sb_event_t *, int);
-static int event_seq_none(sb_event_t *, int);
-static int event_seq_read(sb_event_t *, int);
-static int event_seq_write(sb_event_t *, int);
+static sb_op_execute_event * const memory_kernels[3][3][3][3];
 static void memory_report_intermediate(sb_stat_t *);
 static void memory_report_cumulative(sb_stat_t *);
 
@@ -85,6 +198,9 @@ static sb_test_t memory_test =
   .lname = "Memory functions speed test",
   .ops = {
     .init = memory_init,
+    .thread_init = memory_thread_init,
+    .thread_done = memory_thread_done,
+    .done = memory_done,
     .print_mode = memory_print_mode,
     .next_event = memory_next_event,
     .report_intermediate = memory_report_intermediate,
@@ -97,530 +213,2653 @@ static sb_test_t memory_test =
 
 static ssize_t memory_block_size;
 static long long    memory_total_size;
+static size_t       memory_working_set;
 static unsigned int memory_scope;
 static unsigned int memory_oper;
 static unsigned int memory_access_rnd;
-#ifdef HAVE_LARGE_PAGES
-static unsigned int memory_hugetlb;
-#endif
+static unsigned int memory_page_backend = SB_MEM_PAGE_4K;
+
+static const char * const memory_page_backend_names[] =
+{
+  "4k", "thp-madvise", "thp-always", "hugetlb-2m", "hugetlb-1g"
+};
+
+/*
+  Huge page and page table footprint of the process, sampled around PTE
+  metadata enable and disable to see whether they split huge pages.
+*/
+typedef struct
+{
+  long anon_huge_kb;                  /* AnonHugePages in smaps_rollup */
+  long hugetlb_kb;                    /* Private_Hugetlb in smaps_rollup */
+  long pte_kb;                        /* VmPTE in status */
+} memory_vm_sample_t;
+
+static memory_vm_sample_t memory_vm_populated;
+static memory_vm_sample_t memory_vm_enabled;
+static unsigned int       pte_enable_failures;
+static int                pte_enable_errno;
 
 /* PTE metadata globals */
 static unsigned int pte_meta_enabled = 0;
 static int pte_meta_type = 0;
+static int pte_meta_backend_type = PTE_META_BACKEND_KERNEL;
+static unsigned int pte_meta_granularity = SB_MEM_PTE_GRAN_WORD;
+static unsigned int pte_meta_batch = 1;
+static unsigned int pte_meta_arena_slots;
+static unsigned int pte_meta_read_cache;
+static unsigned int pte_meta_cache_sets;
+static unsigned int pte_meta_async;
+static unsigned int pte_meta_async_drainers;
+static unsigned int pte_meta_sharing = SB_MEM_PTE_SHARE_SCOPE;
+
+static const char * const pte_meta_sharing_names[] =
+{
+  "scope", "private", "shared-page", "shared-pmd", "shared-region"
+};
 
-/* Helper function to prepare MDP=0 metadata */
-static inline int set_pte_meta_direct(unsigned long addr, uint64_t value) {
-    return set_pte_meta(addr, 0, (unsigned long)&value);
-}
+/* PMD-aligned hot PMD targeted by shared-page and shared-pmd */
+static unsigned long pte_hot;
 
-/* Helper function to prepare MDP=1 metadata */
-static inline int set_pte_meta_structured(unsigned long addr, uint32_t version, uint32_t type, const void *payload, uint32_t payload_len) {
-    struct metadata_header header = {
-        .version = version,
-        .type = type,
-        .length = payload_len,
-        .reserved = 0
-    };
-    
-    size_t total_size = sizeof(header) + payload_len;
-    uint8_t *meta_buffer = malloc(total_size);
-    if (!meta_buffer) return -1;
-    
-    memcpy(meta_buffer, &header, sizeof(header));
-    if (payload && payload_len > 0) {
-        memcpy(meta_buffer + sizeof(header), payload, payload_len);
-    }
-    
-    int result = set_pte_meta(addr, 1, (unsigned long)meta_buffer);
-    free(meta_buffer);
-    return result;
-}
+/* Per-thread latency of direct metadata operations, when sharing is set */
+static sb_histogram_t *pte_op_hists;
 
-static ssize_t max_offset;
+/* Cold/warm latency of direct metadata operations */
+static int                   pte_meta_evict_method = PTE_META_EVICT_NONE;
+static struct pte_meta_evict pte_evict;
+static sb_histogram_t        pte_warm_hist;
+static sb_histogram_t        pte_cold_hist;
+
+/* Performance counters, --memory-perf-events */
+typedef struct
+{
+  const char *name;
+  uint32_t   type;
+  uint64_t   config;
+} memory_perf_event_t;
+
+/* A worker's counter group, opened by the worker in memory_thread_init() */
+typedef struct
+{
+  int fds[SB_MEM_PERF_MAX_EVENTS];    /* fds[0] is the group leader */
+} CK_CC_CACHELINE memory_perf_thread_t;
+
+static memory_perf_event_t  memory_perf_events[SB_MEM_PERF_MAX_EVENTS];
+static unsigned int         memory_perf_nevents;
+static int                  memory_perf_user_only;
+static memory_perf_thread_t *memory_perf_threads;
+/*
+  Totals at the previous intermediate and cumulative report, used by the
+  respective reporting thread only
+*/
+static double               memory_perf_last[SB_MEM_PERF_MAX_EVENTS];
+static double               memory_perf_last_cumulative[SB_MEM_PERF_MAX_EVENTS];
+
+/* End-of-run metadata validation */
+static unsigned int pte_meta_validate;
+static unsigned int pte_meta_validate_threads;
+static size_t       pte_meta_val_pages;     /* pages per buffer */
+
+/* Page size and maximum number of pages spanned by a memory block */
+static size_t memory_page_size;
+static size_t memory_block_pages;
+
+/* Number of blocks in the working set of each buffer */
+static size_t memory_ws_blocks;
+
+/* Block of the working set used by the current event of a thread */
+typedef struct
+{
+  size_t *block;
+  size_t next;                /* next block for sequential access */
+} CK_CC_CACHELINE memory_thread_t;
+
+static memory_thread_t *memory_threads;
+
+/*
+  Preformatted MDP=1 record. The header is written once when the arena is
+  created, only the payload is rewritten before each set_pte_meta call.
+*/
+typedef struct
+{
+  struct metadata_header hdr;
+  uint64_t               payload;
+} CK_CC_CACHELINE memory_pte_rec_t;
+
+/*
+  Read cache entry: the result of get_pte_meta for page vpn, valid as long as
+  the write generation of its region is still gen.
+*/
+typedef struct
+{
+  unsigned long vpn;
+  uint64_t      gen;
+  int           err;
+  unsigned char data[SB_MEM_PTE_GET_BUF_SIZE];
+} memory_pte_cache_t;
+
+/* Metadata update queued by a worker for a drainer thread */
+struct memory_pte_req
+{
+  unsigned long addr;
+  uint64_t      value;
+  uint64_t      queued_ns;      /* time the worker queued the update */
+};
+
+CK_RING_PROTOTYPE(memory_pte_req, memory_pte_req)
+
+/*
+  Per-worker SPSC ring. The worker is the only producer, the drainer serving
+  it the only consumer. 'completed' is written by the drainer and lets the
+  worker wait for its updates to become visible before it finishes.
+*/
+typedef struct
+{
+  ck_ring_t             ring;
+  uint64_t              completed CK_CC_CACHELINE;
+  struct memory_pte_req buf[SB_MEM_PTE_RING_SIZE] CK_CC_CACHELINE;
+} memory_pte_ring_t;
+
+/* Drainer thread state */
+typedef struct
+{
+  pthread_t           thread;
+  unsigned int        id;
+  struct pte_meta_vec *vec;     /* updates submitted at once */
+  memory_pte_rec_t    *recs;    /* MDP=1 records backing vec */
+  uint64_t            *queued;  /* queue time of each entry of vec */
+  unsigned int        *worker;  /* worker ring of each entry of vec */
+  uint64_t            drained;
+  uint64_t            calls;
+  uint64_t            lag_sum;
+  uint64_t            lag_max;
+  uint64_t            vis_sum;
+  uint64_t            vis_max;
+} CK_CC_CACHELINE memory_pte_drainer_t;
+
+/* Per-thread PTE metadata state */
+typedef struct
+{
+  unsigned long wc_page;        /* page with a pending combined update, or 0 */
+  uint64_t      wc_value;       /* final value to issue for wc_page */
+  uint64_t      *ev_values;     /* per-event mode: last value of each page */
+  unsigned char *ev_dirty;      /* per-event mode: pages written by the event */
+  uint64_t      ops;            /* metadata operations requested by events */
+  uint64_t      calls;          /* set/get calls issued to the backend */
+  uint64_t      batches;        /* vectored submissions */
+  memory_pte_rec_t *arena;      /* MDP=1 records, pte_meta_arena_slots */
+  unsigned int  arena_next;     /* next arena slot to use */
+  struct pte_meta_vec *batch;   /* pending vectored operations */
+  unsigned int  batch_len;      /* number of pending operations */
+  unsigned char *get_bufs;      /* result buffers for batched gets */
+  uint64_t      *batch_gen;     /* region generations of batched gets */
+  memory_pte_cache_t *cache;    /* direct-mapped get_pte_meta cache */
+  uint64_t      cache_hits;
+  uint64_t      cache_misses;
+  uint64_t      cache_sets;     /* sets issued by the lookup path */
+  uint64_t      cache_stale;    /* hits served right after a set */
+  uint64_t      queued;         /* updates queued to the async ring */
+  uint64_t      depth_sum;      /* ring depth seen at each enqueue */
+  unsigned int  depth_max;
+  uint64_t      ring_full;      /* enqueue retries on a full ring */
+  uint32_t      val_epoch;      /* validation: number of the current event */
+  uint32_t      *val_last;      /* validation: event of the last write to
+                                   each page of the buffer, 0 if none */
+} CK_CC_CACHELINE memory_pte_thread_t;
+
+static memory_pte_thread_t *pte_threads;
+
+/* PTE metadata counters summed over all worker and drainer threads */
+typedef struct
+{
+  uint64_t ops;
+  uint64_t calls;
+  uint64_t batches;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t cache_sets;
+  uint64_t cache_stale;
+  uint64_t queued;
+  uint64_t depth_sum;
+  uint64_t ring_full;
+  uint64_t drained;
+  uint64_t drain_calls;
+  uint64_t lag_sum;
+  uint64_t vis_sum;
+} memory_pte_totals_t;
+
+/*
+  Totals at the previous cumulative report, used by the reporting thread only.
+  Each cumulative report covers the time since the previous one, so counters
+  are reported as deltas against this.
+*/
+static memory_pte_totals_t pte_report_last;
+
+/*
+  Write generations, bumped by the set path after each metadata update so
+  that cached reads of the same region are invalidated.
+*/
+static uint64_t pte_meta_gen[SB_MEM_PTE_GEN_REGIONS];
+
+/* Verifier thread state, checks pages [first, last) of all buffers */
+typedef struct
+{
+  pthread_t thread;
+  size_t    first;
+  size_t    last;
+  uint64_t  checked;
+  uint64_t  missing;            /* written pages without metadata */
+  uint64_t  stale;              /* value of an older write of the same thread */
+  uint64_t  corrupt;            /* value no thread wrote to this page */
+} CK_CC_CACHELINE memory_pte_verifier_t;
+
+/* Asynchronous update offload */
+static memory_pte_ring_t    **pte_rings;
+static memory_pte_drainer_t *pte_drainers;
+static int                  pte_drainers_stop;
+static sb_histogram_t       pte_lag_hist;
+static sb_histogram_t       pte_vis_hist;
+
+/* Cost of expanding and collapsing the page tables of all buffers */
+static struct pte_meta_range_stats pte_enable_stats;
+static struct pte_meta_range_stats pte_disable_stats;
 
 /* Arrays of per-thread buffers and event counters */
 static size_t **buffers;
 static uint64_t *thread_counters;
 
-#ifdef HAVE_LARGE_PAGES
-static void * hugetlb_alloc(size_t size);
-#endif
+/* Helper function to prepare MDP=0 metadata */
+static inline int set_pte_meta_direct(unsigned long addr, uint64_t value) {
+    return set_pte_meta(addr, 0, (unsigned long)&value);
+}
 
-int register_test_memory(sb_list_t *tests)
-{
-  SB_LIST_ADD_TAIL(&memory_test.listitem, tests);
+/* Helper function to set MDP=1 metadata from a preformatted arena record */
+static inline int set_pte_meta_structured(unsigned long addr,
+                                          memory_pte_rec_t *rec,
+                                          uint64_t value) {
+    rec->payload = value;
+    return set_pte_meta(addr, 1, (unsigned long)rec);
+}
 
-  return 0;
+static inline uint64_t *pte_meta_region_gen(unsigned long addr)
+{
+  return &pte_meta_gen[(addr >> PTE_META_PMD_SHIFT) &
+                       (SB_MEM_PTE_GEN_REGIONS - 1)];
 }
 
+/* Invalidate cached reads of the region containing addr */
+static inline void pte_meta_bump_gen(unsigned long addr)
+{
+  if (pte_meta_read_cache)
+    ck_pr_inc_64(pte_meta_region_gen(addr));
+}
 
-int memory_init(void)
+/* Remember a get_pte_meta result read while the region was at gen */
+static inline void pte_meta_cache_fill(memory_pte_thread_t *t,
+                                       unsigned long addr, uint64_t gen,
+                                       int err, const void *data)
 {
-  unsigned int i;
-  char         *s;
-  size_t       *buffer;
+  const unsigned long vpn = addr >> PTE_META_PAGE_SHIFT;
+  memory_pte_cache_t * const c = &t->cache[vpn & (SB_MEM_PTE_CACHE_SLOTS - 1)];
+
+  c->vpn = vpn;
+  c->gen = gen;
+  c->err = err;
+  if (err == 0)
+    memcpy(c->data, data, pte_meta_result_size(pte_meta_type, data));
+}
 
-  memory_block_size = sb_get_value_size("memory-block-size");
-  if (memory_block_size < SIZEOF_SIZE_T ||
-      /* Must be a power of 2 */
-      (memory_block_size & (memory_block_size - 1)) != 0)
-  {
-    log_text(LOG_FATAL, "Invalid value for memory-block-size: %s",
-             sb_get_value_string("memory-block-size"));
-    return 1;
-  }
+/* Next preformatted MDP=1 record of the thread's arena */
+static inline memory_pte_rec_t *pte_meta_arena_get(memory_pte_thread_t *t)
+{
+  memory_pte_rec_t * const rec = &t->arena[t->arena_next];
 
-  max_offset = memory_block_size / SIZEOF_SIZE_T - 1;
+  t->arena_next = (t->arena_next + 1) % pte_meta_arena_slots;
 
-  memory_total_size = sb_get_value_size("memory-total-size");
+  return rec;
+}
 
-  s = sb_get_value_string("memory-scope");
-  if (!strcmp(s, "global"))
-    memory_scope = SB_MEM_SCOPE_GLOBAL;
-  else if (!strcmp(s, "local"))
-    memory_scope = SB_MEM_SCOPE_LOCAL;
-  else
-  {
-    log_text(LOG_FATAL, "Invalid value for memory-scope: %s", s);
-    return 1;
-  }
+/* Submit the pending batch through the vectored API */
+static void pte_meta_batch_submit(int tid)
+{
+  memory_pte_thread_t * const t = &pte_threads[tid];
 
-#ifdef HAVE_LARGE_PAGES
-    memory_hugetlb = sb_get_value_flag("memory-hugetlb");
-#endif  
-    /* Initialize PTE metadata settings */
-  pte_meta_enabled = sb_get_value_flag("memory-pte-meta");
-  pte_meta_type = sb_get_value_int("memory-pte-meta-type");
-  
-  if (pte_meta_type != 0 && pte_meta_type != 1) {
-    log_text(LOG_FATAL, "Invalid value for memory-pte-meta-type: %d (must be 0 or 1)", pte_meta_type);
-    return 1;
-  }
+  if (t->batch_len == 0)
+    return;
 
-  s = sb_get_value_string("memory-oper");
-  if (!strcmp(s, "write"))
-    memory_oper = SB_MEM_OP_WRITE;
-  else if (!strcmp(s, "read"))
-    memory_oper = SB_MEM_OP_READ;
-  else if (!strcmp(s, "none"))
-    memory_oper = SB_MEM_OP_NONE;
-  else
+  if (memory_oper == SB_MEM_OP_WRITE)
   {
-    log_text(LOG_FATAL, "Invalid value for memory-oper: %s", s);
-    return 1;
-  }
+    t->calls += set_pte_meta_v(t->batch, t->batch_len);
 
-  s = sb_get_value_string("memory-access-mode");
-  if (!strcmp(s, "seq"))
-    memory_access_rnd = 0;
-  else if (!strcmp(s, "rnd"))
-    memory_access_rnd = 1;
+    for (unsigned i = 0; i < t->batch_len; i++)
+      pte_meta_bump_gen(t->batch[i].addr);
+  }
   else
   {
-    log_text(LOG_FATAL, "Invalid value for memory-access-mode: %s", s);
-    return 1;
-  }
+    /* Generations are sampled before the lookups, see pte_meta_lookup() */
+    if (pte_meta_read_cache)
+      for (unsigned i = 0; i < t->batch_len; i++)
+        t->batch_gen[i] = ck_pr_load_64(pte_meta_region_gen(t->batch[i].addr));
 
-  if (memory_scope == SB_MEM_SCOPE_GLOBAL)
-  {
-#ifdef HAVE_LARGE_PAGES
-    if (memory_hugetlb)
-      buffer = hugetlb_alloc(memory_block_size);
-    else
-#endif
-      buffer = sb_memalign(memory_block_size, sb_getpagesize());
+    /* Entries get reordered, their result buffer slot still indexes batch_gen */
+    t->calls += get_pte_meta_v(t->batch, t->batch_len);
 
-    if (buffer == NULL)
-    {
-      log_text(LOG_FATAL, "Failed to allocate buffer!");
-      return 1;
-    }
+    if (pte_meta_read_cache)
+      for (unsigned i = 0; i < t->batch_len; i++)
+      {
+        const struct pte_meta_vec * const v = &t->batch[i];
+        const size_t slot = ((unsigned char *) v->ptr - t->get_bufs) /
+          SB_MEM_PTE_GET_BUF_SIZE;
 
-    memset(buffer, 0, memory_block_size);
-    /* Enable PTE metadata for global buffer if requested */
-    if (pte_meta_enabled) {
-      if (enable_pte_meta((unsigned long)buffer) != 0) {
-        log_text(LOG_WARNING, "Failed to enable PTE metadata for global buffer");
-      } else {
-        log_text(LOG_INFO, "PTE metadata enabled for global buffer at %p", buffer);
+        pte_meta_cache_fill(t, v->addr, t->batch_gen[slot], v->err, v->ptr);
       }
-    }
   }
 
-  thread_counters = malloc(sb_globals.threads * sizeof(uint64_t));
-  buffers = malloc(sb_globals.threads * sizeof(void *));
-  if (thread_counters == NULL || buffers == NULL)
-  {
-    log_text(LOG_FATAL, "Failed to allocate thread-local memory!");
-    return 1;
-  }
+  for (unsigned i = 0; i < t->batch_len; i++)
+    if (t->batch[i].err != 0)
+      log_text(LOG_DEBUG, "vectored PTE metadata operation failed for addr "
+               "%lx: %s", t->batch[i].addr, strerror(t->batch[i].err));
 
-  for (i = 0; i < sb_globals.threads; i++)
-  {
-    if (memory_scope == SB_MEM_SCOPE_GLOBAL)
-      buffers[i] = buffer;
-    else
-    {
-#ifdef HAVE_LARGE_PAGES
-      if (memory_hugetlb)
-        buffers[i] = hugetlb_alloc(memory_block_size);
-      else
-#endif
-        buffers[i] = sb_memalign(memory_block_size, sb_getpagesize());
+  t->batches++;
+  t->batch_len = 0;
+}
 
-      if (buffers[i] == NULL)
-      {
-        log_text(LOG_FATAL, "Failed to allocate buffer for thread #%d!", i);
-        return 1;
-      }
+/* Append an operation to the pending batch, submitting it once full */
+static inline struct pte_meta_vec *pte_meta_batch_add(int tid,
+                                                      unsigned long addr)
+{
+  memory_pte_thread_t * const t = &pte_threads[tid];
+  struct pte_meta_vec *v;
 
-      memset(buffers[i], 0, memory_block_size);
-      /* Enable PTE metadata for this buffer if requested */
-      if (pte_meta_enabled) {
-        if (enable_pte_meta((unsigned long)buffers[i]) != 0) {
-          log_text(LOG_WARNING, "Failed to enable PTE metadata for buffer %d", i);
-        } else {
-          log_text(LOG_INFO, "PTE metadata enabled for buffer %d at %p", i, buffers[i]);
-        }
-      }
-    }
+  if (t->batch_len == pte_meta_batch)
+    pte_meta_batch_submit(tid);
 
-    thread_counters[i] =
-      memory_total_size / memory_block_size / sb_globals.threads;
-  }
+  v = &t->batch[t->batch_len++];
+  v->addr = addr;
+  v->mdp = pte_meta_type;
 
-  switch (memory_oper) {
-  case SB_MEM_OP_NONE:
-    memory_test.ops.execute_event =
-      memory_access_rnd ? event_rnd_none : event_seq_none;
-    break;
+  return v;
+}
 
-  case SB_MEM_OP_READ:
-    memory_test.ops.execute_event =
-      memory_access_rnd ? event_rnd_read : event_seq_read;
-    break;
+/* Address whose PTE a metadata operation of thread tid on addr targets */
+static inline unsigned long pte_meta_target(int tid, unsigned long addr)
+{
+  switch (pte_meta_sharing) {
+  case SB_MEM_PTE_SHARE_PAGE:
+    return pte_hot + (addr & (memory_page_size - 1));
 
-  case SB_MEM_OP_WRITE:
-    memory_test.ops.execute_event =
-      memory_access_rnd ? event_rnd_write : event_seq_write;
-    break;
+  case SB_MEM_PTE_SHARE_PMD:
+    return pte_hot + (tid % PTE_META_PTRS_PER_PTE) * memory_page_size +
+      (addr & (memory_page_size - 1));
 
   default:
-    log_text(LOG_FATAL, "Unknown memory request type: %d\n", memory_oper);
-    return 1;
+    return addr;
   }
+}
 
-  /* Use our own limit on the number of events */
-  sb_globals.max_events = 0;
+/*
+  Start timing the direct metadata operation on addr counted as call number
+  t->calls. With --memory-pte-meta-evict every other operation is cold, its
+  page is evicted first.
+*/
+static inline uint64_t pte_meta_op_begin(memory_pte_thread_t *t,
+                                         unsigned long addr)
+{
+  if (pte_meta_evict_method == PTE_META_EVICT_NONE)
+    return pte_op_hists != NULL ? pte_meta_now_ns() : 0;
 
+  if (t->calls & 1)
+    pte_meta_evict(&pte_evict, (void *) (addr & ~(memory_page_size - 1)),
+                   memory_page_size);
 
-  return 0;
+  return pte_meta_now_ns();
 }
 
-
-sb_event_t memory_next_event(int tid)
+/* Record the latency of a direct metadata operation started at start */
+static inline void pte_meta_op_done(int tid, uint64_t start)
 {
-  sb_event_t      req;
+  double us;
 
-  if (memory_total_size > 0 && thread_counters[tid]-- == 0)
-  {
-    req.type = SB_REQ_TYPE_NULL;
-    return req;
-  }
+  if (pte_op_hists == NULL && pte_meta_evict_method == PTE_META_EVICT_NONE)
+    return;
 
-  req.type = SB_REQ_TYPE_MEMORY;
+  us = (pte_meta_now_ns() - start) / 1e3;
 
-  return req;
+  if (pte_op_hists != NULL)
+    sb_histogram_update(&pte_op_hists[tid], us);
+  if (pte_meta_evict_method != PTE_META_EVICT_NONE)
+    sb_histogram_update(pte_threads[tid].calls & 1 ? &pte_cold_hist :
+                        &pte_warm_hist, us);
 }
 
 /*
-  Use either 32- or 64-bit primitives depending on the native word
-  size. ConcurrencyKit ensures the corresponding loads/stores are not optimized
-  away by the compiler.
+  Issue a single metadata update for the page containing addr. mdp is a
+  compile-time constant in the generated event kernels.
 */
-#if SIZEOF_SIZE_T == 4
-# define SIZE_T_LOAD(ptr) ck_pr_load_32((uint32_t *)(ptr))
-# define SIZE_T_STORE(ptr,val) ck_pr_store_32((uint32_t *)(ptr),(uint32_t)(val))
-#elif SIZEOF_SIZE_T == 8
-# define SIZE_T_LOAD(ptr) ck_pr_load_64((uint64_t *)(ptr))
-# define SIZE_T_STORE(ptr,val) ck_pr_store_64((uint64_t *)(ptr),(uint64_t)(val))
-#else
-# error Unsupported platform.
-#endif
-
-int event_rnd_none(sb_event_t *req, int tid)
+static CK_CC_FORCE_INLINE void pte_meta_update(int tid, unsigned long addr,
+                                               uint64_t value, const int mdp)
 {
-  (void) req; /* unused */
-  (void) tid; /* unused */
+  memory_pte_thread_t * const t = &pte_threads[tid];
+  uint64_t start;
+
+  t->ops++;
+  addr = pte_meta_target(tid, addr);
 
-  for (ssize_t i = 0; i <= max_offset; i++)
+  if (pte_meta_async)
   {
-    size_t offset = (volatile size_t) sb_rand_default(0, max_offset);
-    (void) offset; /* unused */
-  }
+    memory_pte_ring_t * const r = pte_rings[tid];
+    struct memory_pte_req req = {
+      .addr = addr,
+      .value = value,
+      .queued_ns = pte_meta_now_ns()
+    };
+    unsigned int depth;
 
-  return 0;
-}
+    while (!ck_ring_enqueue_spsc_size_memory_pte_req(&r->ring, r->buf, &req,
+                                                     &depth))
+    {
+      t->ring_full++;
+      ck_pr_stall();
+    }
 
+    t->queued++;
+    t->depth_sum += depth;
+    if (depth > t->depth_max)
+      t->depth_max = depth;
 
-int event_rnd_read(sb_event_t *req, int tid)
-{
-  (void) req; /* unused */
+    return;
+  }
 
-  for (ssize_t i = 0; i <= max_offset; i++)
+  if (pte_meta_batch > 1)
   {
-    size_t offset = (size_t) sb_rand_default(0, max_offset);
-    
-    /* Call get_pte_meta syscall for each read operation */
-    if (pte_meta_enabled) {
-      unsigned long addr = (unsigned long)(buffers[tid] + offset);
-      if (pte_meta_type == 0) {
-        uint64_t meta_result;
-        int ret = get_pte_meta(addr, &meta_result);
-        (void) ret; (void) meta_result; /* Store result to prevent optimization */
-      } else {
-        /* For MDP=1, allocate buffer for structured metadata */
-        uint8_t meta_buffer[sizeof(struct metadata_header) + 64]; /* Header + some payload space */
-        int ret = get_pte_meta(addr, meta_buffer);
-        (void) ret; /* Store result to prevent optimization */
-      }
+    struct pte_meta_vec * const v = pte_meta_batch_add(tid, addr);
+
+    if (mdp == 0)
+      v->value = value;
+    else
+    {
+      memory_pte_rec_t * const rec = pte_meta_arena_get(t);
+
+      rec->payload = value;
+      v->ptr = rec;
     }
-    
-    size_t val = SIZE_T_LOAD(buffers[tid] + offset);
-    (void) val; /* unused */
+    return;
   }
 
-  return 0;
-}
+  t->calls++;
+  start = pte_meta_op_begin(t, addr);
+
+  if (mdp == 0)
+  {
+    /* MDP=0: Direct u64 metadata */
+    if (set_pte_meta_direct(addr, value) != 0)
+      log_text(LOG_DEBUG, "set_pte_meta_direct failed for addr %lx", addr);
+  }
+  else
+  {
+    /* MDP=1: Structured metadata, no allocations on this path */
+    if (set_pte_meta_structured(addr, pte_meta_arena_get(t), value) != 0)
+      log_text(LOG_DEBUG, "set_pte_meta_structured failed for addr %lx", addr);
+  }
 
+  pte_meta_op_done(tid, start);
+  pte_meta_bump_gen(addr);
+}
 
-int event_rnd_write(sb_event_t *req, int tid)
+/*
+  Update the metadata of the page containing addr from the lookup path, for
+  --memory-pte-meta-read-cache-sets. Like any other set, this bumps the
+  region generation and invalidates cached reads of it in all threads.
+*/
+static void pte_meta_cache_set(memory_pte_thread_t *t, unsigned long addr)
 {
-  (void) req; /* unused */
+  const int ret = pte_meta_type == 0 ?
+    set_pte_meta_direct(addr, t->ops) :
+    set_pte_meta_structured(addr, pte_meta_arena_get(t), t->ops);
 
-  for (ssize_t i = 0; i <= max_offset; i++)
+  if (ret != 0)
+    log_text(LOG_DEBUG, "set_pte_meta failed for addr %lx", addr);
+
+  t->cache_sets++;
+  pte_meta_bump_gen(addr);
+}
+
+/*
+  Look up the metadata of the page containing addr. With the read cache on,
+  the region generation is sampled before calling get_pte_meta, so a set
+  racing with the lookup leaves an entry that is already stale.
+*/
+static inline void pte_meta_lookup(int tid, unsigned long addr)
+{
+  memory_pte_thread_t * const t = &pte_threads[tid];
+  uint64_t gen = 0;
+
+  t->ops++;
+  addr = pte_meta_target(tid, addr);
+
+  if (pte_meta_read_cache)
+  {
+    const unsigned long vpn = addr >> PTE_META_PAGE_SHIFT;
+    const memory_pte_cache_t * const c =
+      &t->cache[vpn & (SB_MEM_PTE_CACHE_SLOTS - 1)];
+    const int set = pte_meta_cache_sets > 0 &&
+      t->ops % pte_meta_cache_sets == 0;
+
+    if (set)
+      pte_meta_cache_set(t, addr);
+
+    gen = ck_pr_load_64(pte_meta_region_gen(addr));
+    if (c->vpn == vpn && c->gen == gen)
+    {
+      /* The set must have invalidated any entry for this page */
+      if (set)
+        t->cache_stale++;
+      t->cache_hits++;
+      return;
+    }
+    t->cache_misses++;
+  }
+
+  if (pte_meta_batch > 1)
+  {
+    struct pte_meta_vec * const v = pte_meta_batch_add(tid, addr);
+
+    v->ptr = t->get_bufs + (t->batch_len - 1) * SB_MEM_PTE_GET_BUF_SIZE;
+    return;
+  }
+
+  t->calls++;
+
+  /* Header + some payload space for MDP=1 */
+  uint8_t meta_buffer[SB_MEM_PTE_GET_BUF_SIZE];
+  const uint64_t start = pte_meta_op_begin(t, addr);
+  int ret = get_pte_meta(addr, meta_buffer);
+
+  pte_meta_op_done(tid, start);
+
+  if (pte_meta_read_cache)
+    pte_meta_cache_fill(t, addr, gen, ret == 0 ? 0 : errno, meta_buffer);
+}
+
+/* Value written to page idx of its buffer by event epoch of thread tid */
+static inline uint64_t pte_meta_val_encode(int tid, size_t idx, uint32_t epoch)
+{
+  return ((uint64_t) (tid + 1) << (2 * SB_MEM_PTE_VAL_BITS)) |
+    ((uint64_t) (idx & SB_MEM_PTE_VAL_MASK) << SB_MEM_PTE_VAL_BITS) | epoch;
+}
+
+/* Start the next validation event of thread tid, skipping epoch 0 */
+static inline void pte_meta_val_next_epoch(int tid)
+{
+  memory_pte_thread_t * const t = &pte_threads[tid];
+
+  t->val_epoch = (t->val_epoch + 1) & SB_MEM_PTE_VAL_MASK;
+  if (t->val_epoch == 0)
+    t->val_epoch = 1;
+}
+
+/*
+  Record a metadata update for a written word. Depending on the granularity,
+  the update is either issued immediately or combined with other updates to
+  the same page, so that only the final value reaches the kernel.
+*/
+static CK_CC_FORCE_INLINE void pte_meta_write(int tid, const size_t *word,
+                                              uint64_t value, const int mdp,
+                                              const unsigned int gran)
+{
+  memory_pte_thread_t * const t = &pte_threads[tid];
+  const unsigned long addr = (unsigned long) word;
+  const unsigned long page = addr & ~(memory_page_size - 1);
+
+  /* Replace the value with one the verifier can attribute to this write */
+  if (pte_meta_validate)
+  {
+    const size_t idx = (page - (unsigned long) buffers[tid]) / memory_page_size;
+
+    t->val_last[idx] = t->val_epoch;
+    value = pte_meta_val_encode(tid, idx, t->val_epoch);
+  }
+
+  switch (gran) {
+  case SB_MEM_PTE_GRAN_WORD:
+    pte_meta_update(tid, addr, value, mdp);
+    break;
+
+  case SB_MEM_PTE_GRAN_PAGE:
+    if (t->wc_page != page)
+    {
+      if (t->wc_page != 0)
+        pte_meta_update(tid, t->wc_page, t->wc_value, mdp);
+      t->wc_page = page;
+    }
+    t->wc_value = value;
+    break;
+
+  case SB_MEM_PTE_GRAN_EVENT:
+    {
+      const unsigned long base = (unsigned long) memory_threads[tid].block &
+        ~(memory_page_size - 1);
+      const size_t idx = (page - base) / memory_page_size;
+
+      t->ev_values[idx] = value;
+      t->ev_dirty[idx] = 1;
+    }
+    break;
+  }
+}
+
+/* Issue updates still pending at the end of an event */
+static CK_CC_FORCE_INLINE void pte_meta_flush(int tid, const int mdp,
+                                              const unsigned int gran)
+{
+  memory_pte_thread_t * const t = &pte_threads[tid];
+
+  if (gran == SB_MEM_PTE_GRAN_PAGE && t->wc_page != 0)
+  {
+    pte_meta_update(tid, t->wc_page, t->wc_value, mdp);
+    t->wc_page = 0;
+  }
+
+  if (gran == SB_MEM_PTE_GRAN_EVENT)
+  {
+    const unsigned long base = (unsigned long) memory_threads[tid].block &
+      ~(memory_page_size - 1);
+
+    for (size_t i = 0; i < memory_block_pages; i++)
+    {
+      if (!t->ev_dirty[i])
+        continue;
+
+      pte_meta_update(tid, base + i * memory_page_size, t->ev_values[i], mdp);
+      t->ev_dirty[i] = 0;
+    }
+  }
+
+  pte_meta_batch_submit(tid);
+}
+
+static ssize_t max_offset;
+
+
+static void *memory_alloc(size_t size);
+static void memory_vm_sample(memory_vm_sample_t *sample);
+static void memory_report_page_backend(void);
+#ifdef HAVE_LARGE_PAGES
+static void memory_check_thp(void);
+#endif
+static void pte_meta_validate_run(void);
+static int memory_perf_init(void);
+static void memory_perf_thread_init(int thread_id);
+static void memory_perf_done(void);
+static double memory_perf_read(double *totals);
+
+/* Issue the n updates collected by a drainer and account for them */
+static void pte_meta_drainer_submit(memory_pte_drainer_t *d, unsigned int n)
+{
+  uint64_t done;
+
+  if (n == 1)
+  {
+    struct pte_meta_vec * const v = &d->vec[0];
+
+    v->err = set_pte_meta(v->addr, v->mdp, v->mdp == 0 ?
+                          (unsigned long) &v->value : (unsigned long) v->ptr)
+      == 0 ? 0 : errno;
+    d->calls++;
+  }
+  else
+    d->calls += set_pte_meta_v(d->vec, n);
+
+  done = pte_meta_now_ns();
+
+  /*
+    The vectored call reorders vec, while queued[] and worker[] keep the
+    dequeue order. All updates become visible at the same time, so both can
+    be walked independently.
+  */
+  for (unsigned i = 0; i < n; i++)
+  {
+    const struct pte_meta_vec * const v = &d->vec[i];
+    const uint64_t vis = done - d->queued[i];
+
+    if (v->err != 0)
+      log_text(LOG_DEBUG, "async set_pte_meta failed for addr %lx: %s",
+               v->addr, strerror(v->err));
+
+    pte_meta_bump_gen(v->addr);
+
+    d->vis_sum += vis;
+    if (vis > d->vis_max)
+      d->vis_max = vis;
+    sb_histogram_update(&pte_vis_hist, vis / 1e3);
+
+    ck_pr_inc_64(&pte_rings[d->worker[i]]->completed);
+  }
+}
+
+/*
+  Drainer thread: serves the rings of workers id, id + ndrainers, ... and
+  issues the queued updates, up to --memory-pte-meta-batch at a time.
+*/
+static void *pte_meta_drainer_proc(void *arg)
+{
+  memory_pte_drainer_t * const d = arg;
+
+  sb_tls_thread_id = SB_BACKGROUND_THREAD_ID;
+  sb_rand_thread_init();
+
+  for (;;)
+  {
+    unsigned int n = 0;
+
+    for (unsigned w = d->id; w < sb_globals.threads && n < pte_meta_batch;
+         w += pte_meta_async_drainers)
+    {
+      memory_pte_ring_t * const r = pte_rings[w];
+      struct memory_pte_req req;
+
+      while (n < pte_meta_batch &&
+             ck_ring_dequeue_spsc_memory_pte_req(&r->ring, r->buf, &req))
+      {
+        struct pte_meta_vec * const v = &d->vec[n];
+        const uint64_t lag = pte_meta_now_ns() - req.queued_ns;
+
+        v->addr = req.addr;
+        v->mdp = pte_meta_type;
+        if (pte_meta_type == 0)
+          v->value = req.value;
+        else
+        {
+          d->recs[n].payload = req.value;
+          v->ptr = &d->recs[n];
+        }
+        d->queued[n] = req.queued_ns;
+        d->worker[n] = w;
+        n++;
+
+        d->drained++;
+        d->lag_sum += lag;
+        if (lag > d->lag_max)
+          d->lag_max = lag;
+        sb_histogram_update(&pte_lag_hist, lag / 1e3);
+      }
+    }
+
+    if (n > 0)
+      pte_meta_drainer_submit(d, n);
+    else if (ck_pr_load_int(&pte_drainers_stop))
+      break;
+    else
+      sched_yield();
+  }
+
+  return NULL;
+}
+
+/* Allocate the worker rings and start the drainer threads */
+static int pte_meta_async_start(void)
+{
+  if (sb_histogram_init(&pte_lag_hist, SB_MEM_PTE_HIST_SIZE,
+                        SB_MEM_PTE_HIST_MIN, SB_MEM_PTE_HIST_MAX) ||
+      sb_histogram_init(&pte_vis_hist, SB_MEM_PTE_HIST_SIZE,
+                        SB_MEM_PTE_HIST_MIN, SB_MEM_PTE_HIST_MAX))
+    return 1;
+
+  pte_rings = calloc(sb_globals.threads, sizeof(memory_pte_ring_t *));
+  pte_drainers = sb_memalign(pte_meta_async_drainers *
+                             sizeof(memory_pte_drainer_t), CK_MD_CACHELINE);
+  if (pte_rings == NULL || pte_drainers == NULL)
+    goto oom;
+
+  for (unsigned i = 0; i < sb_globals.threads; i++)
+  {
+    pte_rings[i] = sb_memalign(sizeof(memory_pte_ring_t), CK_MD_CACHELINE);
+    if (pte_rings[i] == NULL)
+      goto oom;
+
+    ck_ring_init(&pte_rings[i]->ring, SB_MEM_PTE_RING_SIZE);
+    pte_rings[i]->completed = 0;
+  }
+
+  memset(pte_drainers, 0,
+         pte_meta_async_drainers * sizeof(memory_pte_drainer_t));
+
+  for (unsigned i = 0; i < pte_meta_async_drainers; i++)
+  {
+    memory_pte_drainer_t * const d = &pte_drainers[i];
+
+    d->id = i;
+    d->vec = calloc(pte_meta_batch, sizeof(struct pte_meta_vec));
+    d->recs = sb_memalign(pte_meta_batch * sizeof(memory_pte_rec_t),
+                          CK_MD_CACHELINE);
+    d->queued = calloc(pte_meta_batch, sizeof(uint64_t));
+    d->worker = calloc(pte_meta_batch, sizeof(unsigned int));
+    if (d->vec == NULL || d->recs == NULL || d->queued == NULL ||
+        d->worker == NULL)
+      goto oom;
+
+    for (unsigned j = 0; j < pte_meta_batch; j++)
+    {
+      d->recs[j].hdr.version = SB_MEM_PTE_META_VERSION;
+      d->recs[j].hdr.type = SB_MEM_PTE_META_TYPE;
+      d->recs[j].hdr.length = sizeof(d->recs[j].payload);
+      d->recs[j].hdr.reserved = 0;
+    }
+  }
+
+  for (unsigned i = 0; i < pte_meta_async_drainers; i++)
+  {
+    if (sb_thread_create(&pte_drainers[i].thread, NULL,
+                         pte_meta_drainer_proc, &pte_drainers[i]) != 0)
+    {
+      log_errno(LOG_FATAL, "Failed to create PTE metadata drainer thread");
+      /* Let the drainers started so far exit */
+      ck_pr_store_int(&pte_drainers_stop, 1);
+      for (unsigned j = 0; j < i; j++)
+        sb_thread_join(pte_drainers[j].thread, NULL);
+      pte_meta_async_drainers = 0;
+      return 1;
+    }
+  }
+
+  return 0;
+
+oom:
+  log_text(LOG_FATAL, "Failed to allocate PTE metadata rings!");
+  pte_meta_async_drainers = 0;
+  return 1;
+}
+
+/* Stop the drainer threads once all rings are empty */
+static void pte_meta_async_stop(void)
+{
+  ck_pr_store_int(&pte_drainers_stop, 1);
+
+  for (unsigned i = 0; i < pte_meta_async_drainers; i++)
+    if (sb_thread_join(pte_drainers[i].thread, NULL))
+      log_errno(LOG_WARNING, "Failed to join PTE metadata drainer thread");
+}
+
+int register_test_memory(sb_list_t *tests)
+{
+  SB_LIST_ADD_TAIL(&memory_test.listitem, tests);
+
+  return 0;
+}
+
+
+int memory_init(void)
+{
+  unsigned int i;
+  char         *s;
+  size_t       *buffer;
+  int          access;
+
+  memory_block_size = sb_get_value_size("memory-block-size");
+  if (memory_block_size < SIZEOF_SIZE_T ||
+      /* Must be a power of 2 */
+      (memory_block_size & (memory_block_size - 1)) != 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-block-size: %s",
+             sb_get_value_string("memory-block-size"));
+    return 1;
+  }
+
+  max_offset = memory_block_size / SIZEOF_SIZE_T - 1;
+
+  memory_total_size = sb_get_value_size("memory-total-size");
+
+  memory_working_set = sb_get_value_size("memory-working-set");
+  if (memory_working_set == 0)
+    memory_working_set = memory_block_size;
+  if (memory_working_set < (size_t) memory_block_size ||
+      memory_working_set % memory_block_size != 0 ||
+      memory_working_set / memory_block_size > UINT32_MAX)
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-working-set: %s (must be a "
+             "multiple of memory-block-size)",
+             sb_get_value_string("memory-working-set"));
+    return 1;
+  }
+  memory_ws_blocks = memory_working_set / memory_block_size;
+
+  s = sb_get_value_string("memory-scope");
+  if (!strcmp(s, "global"))
+    memory_scope = SB_MEM_SCOPE_GLOBAL;
+  else if (!strcmp(s, "local"))
+    memory_scope = SB_MEM_SCOPE_LOCAL;
+  else
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-scope: %s", s);
+    return 1;
+  }
+
+#ifdef HAVE_LARGE_PAGES
+  s = sb_get_value_string("memory-page-backend");
+  for (i = 0; i < SB_MEM_PAGE_BACKENDS; i++)
+    if (!strcmp(s, memory_page_backend_names[i]))
+      break;
+  if (i == SB_MEM_PAGE_BACKENDS)
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-page-backend: %s", s);
+    return 1;
+  }
+  memory_page_backend = i;
+
+  /* --memory-hugetlb is kept as a shorthand for hugetlb-2m */
+  if (sb_get_value_flag("memory-hugetlb"))
+    memory_page_backend = SB_MEM_PAGE_HUGETLB_2M;
+
+  if (memory_page_backend == SB_MEM_PAGE_THP_MADVISE ||
+      memory_page_backend == SB_MEM_PAGE_THP_ALWAYS)
+    memory_check_thp();
+#endif
+    /* Initialize PTE metadata settings */
+  pte_meta_enabled = sb_get_value_flag("memory-pte-meta");
+  pte_meta_type = sb_get_value_int("memory-pte-meta-type");
+  
+  if (pte_meta_type != 0 && pte_meta_type != 1) {
+    log_text(LOG_FATAL, "Invalid value for memory-pte-meta-type: %d (must be 0 or 1)", pte_meta_type);
+    return 1;
+  }
+
+  s = sb_get_value_string("memory-pte-meta-backend");
+  pte_meta_backend_type = pte_meta_parse_backend(s);
+  if (pte_meta_backend_type < 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-pte-meta-backend: %s", s);
+    return 1;
+  }
+  pte_meta_set_backend(pte_meta_backend_type);
+
+  s = sb_get_value_string("memory-pte-meta-granularity");
+  if (!strcmp(s, "word"))
+    pte_meta_granularity = SB_MEM_PTE_GRAN_WORD;
+  else if (!strcmp(s, "page"))
+    pte_meta_granularity = SB_MEM_PTE_GRAN_PAGE;
+  else if (!strcmp(s, "event"))
+    pte_meta_granularity = SB_MEM_PTE_GRAN_EVENT;
+  else
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-pte-meta-granularity: %s", s);
+    return 1;
+  }
+
+  if (sb_get_value_int("memory-pte-meta-batch") < 1)
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-pte-meta-batch: %d",
+             sb_get_value_int("memory-pte-meta-batch"));
+    return 1;
+  }
+  pte_meta_batch = sb_get_value_int("memory-pte-meta-batch");
+
+  pte_meta_read_cache = sb_get_value_flag("memory-pte-meta-read-cache");
+  if (sb_get_value_int("memory-pte-meta-read-cache-sets") < 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-pte-meta-read-cache-sets: "
+             "%d", sb_get_value_int("memory-pte-meta-read-cache-sets"));
+    return 1;
+  }
+  pte_meta_cache_sets = pte_meta_read_cache ?
+    sb_get_value_int("memory-pte-meta-read-cache-sets") : 0;
+
+  pte_meta_async = sb_get_value_flag("memory-pte-meta-async");
+  if (sb_get_value_int("memory-pte-meta-async-drainers") < 1)
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-pte-meta-async-drainers: %d",
+             sb_get_value_int("memory-pte-meta-async-drainers"));
+    return 1;
+  }
+  pte_meta_async_drainers = sb_get_value_int("memory-pte-meta-async-drainers");
+
+  s = sb_get_value_string("memory-pte-meta-sharing");
+  for (i = 0; i < SB_MEM_PTE_SHARE_MODES; i++)
+    if (!strcmp(s, pte_meta_sharing_names[i]))
+      break;
+  if (i == SB_MEM_PTE_SHARE_MODES)
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-pte-meta-sharing: %s", s);
+    return 1;
+  }
+  pte_meta_sharing = i;
+
+  /* private and shared-region decide how the buffers are allocated */
+  if (pte_meta_sharing == SB_MEM_PTE_SHARE_PRIVATE)
+    memory_scope = SB_MEM_SCOPE_LOCAL;
+  else if (pte_meta_sharing == SB_MEM_PTE_SHARE_REGION)
+    memory_scope = SB_MEM_SCOPE_GLOBAL;
+
+  /* Records of a pending batch must not be reused before it is submitted */
+  pte_meta_arena_slots = SB_MAX(pte_meta_batch, SB_MEM_PTE_ARENA_SLOTS);
+
+  memory_page_size = sb_getpagesize();
+  /* A block that is not page-aligned can span one more page */
+  memory_block_pages = (memory_block_size + memory_page_size - 1) /
+    memory_page_size + 1;
+
+  s = sb_get_value_string("memory-oper");
+  if (!strcmp(s, "write"))
+    memory_oper = SB_MEM_OP_WRITE;
+  else if (!strcmp(s, "read"))
+    memory_oper = SB_MEM_OP_READ;
+  else if (!strcmp(s, "none"))
+    memory_oper = SB_MEM_OP_NONE;
+  else
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-oper: %s", s);
+    return 1;
+  }
+
+  s = sb_get_value_string("memory-access-mode");
+  if (!strcmp(s, "seq"))
+    memory_access_rnd = 0;
+  else if (!strcmp(s, "rnd"))
+    memory_access_rnd = 1;
+  else
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-access-mode: %s", s);
+    return 1;
+  }
+
+  if (memory_perf_init() != 0)
+    return 1;
+
+  pte_meta_validate = sb_get_value_flag("memory-pte-meta-validate");
+  if (sb_get_value_int("memory-pte-meta-validate-threads") < 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-pte-meta-validate-threads: "
+             "%d", sb_get_value_int("memory-pte-meta-validate-threads"));
+    return 1;
+  }
+  pte_meta_validate_threads =
+    sb_get_value_int("memory-pte-meta-validate-threads");
+  if (pte_meta_validate_threads == 0)
+    pte_meta_validate_threads = sb_globals.threads;
+
+  if (pte_meta_validate)
+  {
+    /* Expected values are tracked per page of the buffers being written */
+    if (!pte_meta_enabled || memory_oper != SB_MEM_OP_WRITE ||
+        pte_meta_sharing == SB_MEM_PTE_SHARE_PAGE ||
+        pte_meta_sharing == SB_MEM_PTE_SHARE_PMD)
+    {
+      log_text(LOG_WARNING, "--memory-pte-meta-validate requires "
+               "--memory-pte-meta=on and --memory-oper=write with metadata "
+               "on the buffers, validation disabled");
+      pte_meta_validate = 0;
+    }
+    else if (memory_working_set % memory_page_size != 0)
+    {
+      log_text(LOG_FATAL, "--memory-pte-meta-validate requires "
+               "memory-working-set to be a multiple of the page size (%zu)",
+               memory_page_size);
+      return 1;
+    }
+    else if (sb_globals.threads > SB_MEM_PTE_VAL_MAX_THREADS)
+    {
+      log_text(LOG_FATAL, "--memory-pte-meta-validate supports at most %u "
+               "threads", SB_MEM_PTE_VAL_MAX_THREADS);
+      return 1;
+    }
+    pte_meta_val_pages = memory_working_set / memory_page_size;
+  }
+
+  if (memory_scope == SB_MEM_SCOPE_GLOBAL)
+  {
+    buffer = memory_alloc(memory_working_set);
+
+    if (buffer == NULL)
+    {
+      log_text(LOG_FATAL, "Failed to allocate buffer!");
+      return 1;
+    }
+
+    memset(buffer, 0, memory_working_set);
+  }
+
+  thread_counters = malloc(sb_globals.threads * sizeof(uint64_t));
+  buffers = malloc(sb_globals.threads * sizeof(void *));
+  memory_threads = sb_alloc_per_thread_array(sizeof(memory_thread_t));
+  pte_threads = sb_alloc_per_thread_array(sizeof(memory_pte_thread_t));
+  if (thread_counters == NULL || buffers == NULL || memory_threads == NULL ||
+      pte_threads == NULL)
+  {
+    log_text(LOG_FATAL, "Failed to allocate thread-local memory!");
+    return 1;
+  }
+
+  for (i = 0; i < sb_globals.threads; i++)
+  {
+    if (memory_scope == SB_MEM_SCOPE_GLOBAL)
+      buffers[i] = buffer;
+    else
+    {
+      buffers[i] = memory_alloc(memory_working_set);
+
+      if (buffers[i] == NULL)
+      {
+        log_text(LOG_FATAL, "Failed to allocate buffer for thread #%d!", i);
+        return 1;
+      }
+
+      memset(buffers[i], 0, memory_working_set);
+    }
+
+    thread_counters[i] =
+      memory_total_size / memory_block_size / sb_globals.threads;
+
+    /* Spread sequential walks of a shared working set across threads */
+    memory_threads[i].block = buffers[i];
+    if (memory_scope == SB_MEM_SCOPE_GLOBAL)
+      memory_threads[i].next = memory_ws_blocks * i / sb_globals.threads;
+
+    if (pte_meta_enabled && pte_meta_granularity == SB_MEM_PTE_GRAN_EVENT)
+    {
+      pte_threads[i].ev_values = calloc(memory_block_pages, sizeof(uint64_t));
+      pte_threads[i].ev_dirty = calloc(memory_block_pages, 1);
+      if (pte_threads[i].ev_values == NULL || pte_threads[i].ev_dirty == NULL)
+      {
+        log_text(LOG_FATAL, "Failed to allocate thread-local memory!");
+        return 1;
+      }
+    }
+
+    if (pte_meta_validate)
+    {
+      pte_threads[i].val_last = calloc(pte_meta_val_pages, sizeof(uint32_t));
+      if (pte_threads[i].val_last == NULL)
+      {
+        log_text(LOG_FATAL, "Failed to allocate thread-local memory!");
+        return 1;
+      }
+    }
+  }
+
+  /*
+    Enable PTE metadata for every PMD of the buffers once all of them are
+    populated, so that the samples taken around it only see its effect.
+  */
+  memory_vm_sample(&memory_vm_populated);
+
+  for (i = 0; pte_meta_enabled && i < sb_globals.threads; i++)
+  {
+    if (memory_scope == SB_MEM_SCOPE_GLOBAL && i > 0)
+      break;
+
+    if (enable_pte_meta_range((unsigned long)buffers[i], memory_working_set,
+                              &pte_enable_stats) != 0)
+    {
+      pte_enable_failures++;
+      pte_enable_errno = errno;
+      log_errno(LOG_WARNING, "Failed to enable PTE metadata for buffer %u", i);
+    }
+    else
+      log_text(LOG_INFO, "PTE metadata enabled for buffer %u at %p", i,
+               buffers[i]);
+  }
+
+  /* The hot PMD targeted instead of the buffers by shared-page/shared-pmd */
+  if (pte_meta_enabled && (pte_meta_sharing == SB_MEM_PTE_SHARE_PAGE ||
+                           pte_meta_sharing == SB_MEM_PTE_SHARE_PMD))
+  {
+    void * const hot = sb_memalign(PTE_META_PMD_SIZE, PTE_META_PMD_SIZE);
+
+    if (hot == NULL)
+    {
+      log_text(LOG_FATAL, "Failed to allocate the hot PMD!");
+      return 1;
+    }
+#ifdef MADV_NOHUGEPAGE
+    madvise(hot, PTE_META_PMD_SIZE, MADV_NOHUGEPAGE);
+#endif
+    memset(hot, 0, PTE_META_PMD_SIZE);
+    pte_hot = (unsigned long) hot;
+
+    if (enable_pte_meta_range(pte_hot, PTE_META_PMD_SIZE,
+                              &pte_enable_stats) != 0)
+    {
+      pte_enable_failures++;
+      pte_enable_errno = errno;
+      log_errno(LOG_WARNING, "Failed to enable PTE metadata for the hot PMD");
+    }
+  }
+
+  memory_vm_sample(&memory_vm_enabled);
+
+  if (pte_meta_enabled && pte_meta_sharing != SB_MEM_PTE_SHARE_SCOPE)
+  {
+    if (pte_meta_batch > 1 || pte_meta_async)
+      log_text(LOG_WARNING, "Per-thread PTE metadata latency is only "
+               "collected for direct operations, not with batching or async "
+               "updates");
+    else
+    {
+      pte_op_hists = calloc(sb_globals.threads, sizeof(sb_histogram_t));
+      if (pte_op_hists == NULL)
+      {
+        log_text(LOG_FATAL, "Failed to allocate thread-local memory!");
+        return 1;
+      }
+      for (i = 0; i < sb_globals.threads; i++)
+        if (sb_histogram_init(&pte_op_hists[i], SB_MEM_PTE_HIST_SIZE,
+                              SB_MEM_PTE_HIST_MIN, SB_MEM_PTE_HIST_MAX))
+          return 1;
+    }
+  }
+
+  s = sb_get_value_string("memory-pte-meta-evict");
+  pte_meta_evict_method = pte_meta_parse_evict(s);
+  if (pte_meta_evict_method < 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-pte-meta-evict: %s", s);
+    return 1;
+  }
+
+  if (!pte_meta_enabled)
+    pte_meta_evict_method = PTE_META_EVICT_NONE;
+  else if (pte_meta_evict_method != PTE_META_EVICT_NONE &&
+           (pte_meta_batch > 1 || pte_meta_async))
+  {
+    log_text(LOG_WARNING, "Cold/warm PTE metadata latency is only collected "
+             "for direct operations, not with batching or async updates");
+    pte_meta_evict_method = PTE_META_EVICT_NONE;
+  }
+
+  if (pte_meta_evict_method != PTE_META_EVICT_NONE)
+  {
+    if (pte_meta_evict_init(&pte_evict, pte_meta_evict_method) != 0)
+    {
+      log_errno(LOG_FATAL, "Failed to map the eviction scratch area");
+      return 1;
+    }
+    if (sb_histogram_init(&pte_warm_hist, SB_MEM_PTE_HIST_SIZE,
+                          SB_MEM_PTE_HIST_MIN, SB_MEM_PTE_HIST_MAX) ||
+        sb_histogram_init(&pte_cold_hist, SB_MEM_PTE_HIST_SIZE,
+                          SB_MEM_PTE_HIST_MIN, SB_MEM_PTE_HIST_MAX))
+      return 1;
+  }
+
+  /* Pick the event kernel specialized for this configuration */
+  if (!memory_access_rnd)
+    access = SB_MEM_ACCESS_SEQ;
+  else if (!strcmp(sb_get_value_string("rand-type"), "uniform"))
+    access = SB_MEM_ACCESS_RNDU;
+  else
+    access = SB_MEM_ACCESS_RND;
+
+  memory_test.ops.execute_event =
+    memory_kernels[access][memory_oper]
+    [pte_meta_enabled ? SB_MEM_META_MDP0 + pte_meta_type : SB_MEM_META_OFF]
+    [pte_meta_granularity];
+
+  /* Use our own limit on the number of events */
+  sb_globals.max_events = 0;
+
+  if (pte_meta_enabled && pte_meta_async && memory_oper == SB_MEM_OP_WRITE &&
+      pte_meta_async_start())
+    return 1;
+
+  return 0;
+}
+
+
+/*
+  Create the per-thread arena of preformatted MDP=1 records and the vectored
+  batch buffers.
+*/
+
+int memory_thread_init(int thread_id)
+{
+  memory_pte_thread_t * const t = &pte_threads[thread_id];
+
+  if (memory_perf_nevents > 0)
+    memory_perf_thread_init(thread_id);
+
+  if (!pte_meta_enabled)
+    return 0;
+
+  if (pte_meta_batch > 1)
+  {
+    t->batch = calloc(pte_meta_batch, sizeof(struct pte_meta_vec));
+    t->get_bufs = calloc(pte_meta_batch, SB_MEM_PTE_GET_BUF_SIZE);
+    t->batch_gen = calloc(pte_meta_batch, sizeof(uint64_t));
+    if (t->batch == NULL || t->get_bufs == NULL || t->batch_gen == NULL)
+    {
+      log_text(LOG_FATAL, "Failed to allocate PTE metadata batch for thread "
+               "#%d!", thread_id);
+      return 1;
+    }
+    t->batch_len = 0;
+  }
+
+  if (pte_meta_read_cache)
+  {
+    t->cache = sb_memalign(SB_MEM_PTE_CACHE_SLOTS * sizeof(memory_pte_cache_t),
+                           CK_MD_CACHELINE);
+    if (t->cache == NULL)
+    {
+      log_text(LOG_FATAL, "Failed to allocate PTE metadata read cache for "
+               "thread #%d!", thread_id);
+      return 1;
+    }
+
+    /* No page has VPN ~0, so all entries start out invalid */
+    for (unsigned i = 0; i < SB_MEM_PTE_CACHE_SLOTS; i++)
+      t->cache[i].vpn = ~0UL;
+  }
+
+  if (pte_meta_type != 1)
+    return 0;
+
+  t->arena = sb_memalign(pte_meta_arena_slots * sizeof(memory_pte_rec_t),
+                         CK_MD_CACHELINE);
+  if (t->arena == NULL)
+  {
+    log_text(LOG_FATAL, "Failed to allocate PTE metadata arena for thread #%d!",
+             thread_id);
+    return 1;
+  }
+
+  for (unsigned i = 0; i < pte_meta_arena_slots; i++)
+  {
+    t->arena[i].hdr.version = SB_MEM_PTE_META_VERSION;
+    t->arena[i].hdr.type = SB_MEM_PTE_META_TYPE;
+    t->arena[i].hdr.length = sizeof(t->arena[i].payload);
+    t->arena[i].hdr.reserved = 0;
+    t->arena[i].payload = 0;
+  }
+  t->arena_next = 0;
+
+  return 0;
+}
+
+
+int memory_thread_done(int thread_id)
+{
+  memory_pte_thread_t * const t = &pte_threads[thread_id];
+
+  /* Wait for the drainer to make all queued updates visible */
+  if (pte_rings != NULL)
+    while (ck_pr_load_64(&pte_rings[thread_id]->completed) != t->queued)
+      sched_yield();
+
+  free(t->arena);
+  t->arena = NULL;
+  free(t->batch);
+  t->batch = NULL;
+  free(t->get_bufs);
+  t->get_bufs = NULL;
+  free(t->batch_gen);
+  t->batch_gen = NULL;
+  free(t->cache);
+  t->cache = NULL;
+
+  return 0;
+}
+
+
+/* Collapse the page tables expanded by memory_init() */
+
+int memory_done(void)
+{
+  memory_perf_done();
+
+  if (!pte_meta_enabled)
+    return 0;
+
+  if (pte_rings != NULL)
+    pte_meta_async_stop();
+
+  pte_meta_evict_destroy(&pte_evict);
+
+  /* All updates are visible now, check them before the tables collapse */
+  if (pte_meta_validate)
+    pte_meta_validate_run();
+
+  for (unsigned i = 0; i < sb_globals.threads; i++)
+  {
+    if (memory_scope == SB_MEM_SCOPE_GLOBAL && i > 0)
+      break;
+
+    if (disable_pte_meta_range((unsigned long) buffers[i], memory_working_set,
+                               &pte_disable_stats) != 0)
+      log_errno(LOG_WARNING, "Failed to disable PTE metadata for buffer %u", i);
+  }
+
+  if (pte_hot != 0 && disable_pte_meta_range(pte_hot, PTE_META_PMD_SIZE,
+                                             &pte_disable_stats) != 0)
+    log_errno(LOG_WARNING, "Failed to disable PTE metadata for the hot PMD");
+
+  log_text(LOG_NOTICE, "PTE metadata disable: %lu PMDs collapsed in %.3f ms "
+           "(%.2f us per PMD)\n", pte_disable_stats.pmds,
+           pte_disable_stats.ns / 1e6, pte_disable_stats.pmds > 0 ?
+           pte_disable_stats.ns / 1e3 / pte_disable_stats.pmds : 0.0);
+
+  if (memory_page_backend != SB_MEM_PAGE_4K)
+  {
+    memory_vm_sample_t vm;
+
+    memory_vm_sample(&vm);
+    log_text(LOG_NOTICE, "After PTE metadata disable: AnonHugePages %ld kB, "
+             "Private_Hugetlb %ld kB, VmPTE %ld kB\n", vm.anon_huge_kb,
+             vm.hugetlb_kb, vm.pte_kb);
+  }
+
+  return 0;
+}
+
+
+sb_event_t memory_next_event(int tid)
+{
+  sb_event_t      req;
+
+  if (memory_total_size > 0 && thread_counters[tid]-- == 0)
+  {
+    req.type = SB_REQ_TYPE_NULL;
+    return req;
+  }
+
+  req.type = SB_REQ_TYPE_MEMORY;
+
+  return req;
+}
+
+/*
+  Use either 32- or 64-bit primitives depending on the native word
+  size. ConcurrencyKit ensures the corresponding loads/stores are not optimized
+  away by the compiler.
+*/
+#if SIZEOF_SIZE_T == 4
+# define SIZE_T_LOAD(ptr) ck_pr_load_32((uint32_t *)(ptr))
+# define SIZE_T_STORE(ptr,val) ck_pr_store_32((uint32_t *)(ptr),(uint32_t)(val))
+#elif SIZEOF_SIZE_T == 8
+# define SIZE_T_LOAD(ptr) ck_pr_load_64((uint64_t *)(ptr))
+# define SIZE_T_STORE(ptr,val) ck_pr_store_64((uint64_t *)(ptr),(uint64_t)(val))
+#else
+# error Unsupported platform.
+#endif
+
+/* sb_rand_uniform(), inlined into the uniform random access kernels */
+static inline uint32_t memory_rand_uniform(uint32_t a, uint32_t b)
+{
+  return a + sb_rand_uniform_double() * (b - a + 1);
+}
+
+static CK_CC_FORCE_INLINE size_t memory_rand_offset(const int access)
+{
+  if (access == SB_MEM_ACCESS_RNDU)
+    return memory_rand_uniform(0, max_offset);
+
+  return sb_rand_default(0, max_offset);
+}
+
+/* Select the block of the working set accessed by the next event */
+static CK_CC_FORCE_INLINE size_t *memory_next_block(int tid, const int access)
+{
+  memory_thread_t * const m = &memory_threads[tid];
+  size_t blk;
+
+  if (memory_ws_blocks == 1)
+    return m->block;
+
+  if (access == SB_MEM_ACCESS_SEQ)
+  {
+    blk = m->next;
+    if (++m->next == memory_ws_blocks)
+      m->next = 0;
+  }
+  else if (access == SB_MEM_ACCESS_RNDU)
+    blk = memory_rand_uniform(0, memory_ws_blocks - 1);
+  else
+    blk = sb_rand_default(0, memory_ws_blocks - 1);
+
+  m->block = (size_t *) ((char *) buffers[tid] + blk * memory_block_size);
+
+  return m->block;
+}
+
+/*
+  Generic event body. All arguments but tid are compile-time constants in the
+  kernels generated below, so the checks on them are folded away and each
+  kernel only keeps the loop it needs. Batching, async updates and the read
+  cache remain run-time checks inside the PTE metadata helpers.
+*/
+static CK_CC_FORCE_INLINE int memory_event(int tid, const int access,
+                                           const unsigned int oper,
+                                           const int meta,
+                                           const unsigned int gran)
+{
+  const int mdp = meta - SB_MEM_META_MDP0;
+  size_t * const base = memory_next_block(tid, access);
+
+  if (meta != SB_MEM_META_OFF && oper == SB_MEM_OP_WRITE && pte_meta_validate)
+    pte_meta_val_next_epoch(tid);
+
+  if (access == SB_MEM_ACCESS_SEQ)
+  {
+    size_t counter = 0;
+
+    switch (oper) {
+    case SB_MEM_OP_NONE:
+      for (size_t *buf = base, *end = buf + max_offset; buf <= end; buf++)
+      {
+        ck_pr_barrier();
+        /* nop */
+      }
+      break;
+
+    case SB_MEM_OP_READ:
+      for (size_t *buf = base, *end = buf + max_offset; buf < end; buf++)
+      {
+        /* Look up the PTE metadata for each read operation */
+        if (meta != SB_MEM_META_OFF)
+          pte_meta_lookup(tid, (unsigned long)buf);
+
+        size_t val = SIZE_T_LOAD(buf);
+        (void) val; /* unused */
+      }
+      break;
+
+    case SB_MEM_OP_WRITE:
+      for (size_t *buf = base, *end = buf + max_offset; buf < end;
+           buf++, counter++)
+      {
+        /* Record a metadata update for each write operation */
+        if (meta != SB_MEM_META_OFF)
+          pte_meta_write(tid, buf, (uint64_t) counter, mdp, gran); /* Use counter as metadata */
+
+        SIZE_T_STORE(buf, (size_t) tid);
+      }
+      break;
+    }
+  }
+  else
+  {
+    for (ssize_t i = 0; i <= max_offset; i++)
+    {
+      switch (oper) {
+      case SB_MEM_OP_NONE:
+        {
+          size_t offset = (volatile size_t) memory_rand_offset(access);
+          (void) offset; /* unused */
+        }
+        break;
+
+      case SB_MEM_OP_READ:
+        {
+          size_t offset = memory_rand_offset(access);
+
+          /* Look up the PTE metadata for each read operation */
+          if (meta != SB_MEM_META_OFF)
+            pte_meta_lookup(tid, (unsigned long)(base + offset));
+
+          size_t val = SIZE_T_LOAD(base + offset);
+          (void) val; /* unused */
+        }
+        break;
+
+      case SB_MEM_OP_WRITE:
+        {
+          size_t offset = memory_rand_offset(access);
+
+          /* Record a metadata update for each write operation */
+          if (meta != SB_MEM_META_OFF)
+            pte_meta_write(tid, base + offset, (uint64_t) i, mdp, gran); /* Use loop counter as metadata */
+
+          SIZE_T_STORE(base + offset, i);
+        }
+        break;
+      }
+    }
+  }
+
+  if (meta != SB_MEM_META_OFF)
+  {
+    if (oper == SB_MEM_OP_WRITE)
+      pte_meta_flush(tid, mdp, gran);
+    else if (oper == SB_MEM_OP_READ)
+      pte_meta_batch_submit(tid);
+  }
+
+  return 0;
+}
+
+/*
+  Expand one kernel per access mode x operation x PTE metadata mode x
+  granularity. Kernels whose configuration does not depend on a dimension
+  (e.g. granularity for reads) compile to identical code.
+*/
+#define MEMORY_KERNEL(acc, op, meta, gran)                              \
+  static int event_##acc##_##op##_##meta##_##gran(sb_event_t *req, int tid) \
+  {                                                                     \
+    (void) req; /* unused */                                            \
+    return memory_event(tid, SB_MEM_ACCESS_##acc, SB_MEM_OP_##op,       \
+                        SB_MEM_META_##meta, SB_MEM_PTE_GRAN_##gran);    \
+  }
+
+#define MEMORY_KERNELS_GRAN(acc, op, meta)                              \
+  MEMORY_KERNEL(acc, op, meta, WORD)                                    \
+  MEMORY_KERNEL(acc, op, meta, PAGE)                                    \
+  MEMORY_KERNEL(acc, op, meta, EVENT)
+
+#define MEMORY_KERNELS_META(acc, op)                                    \
+  MEMORY_KERNELS_GRAN(acc, op, OFF)                                     \
+  MEMORY_KERNELS_GRAN(acc, op, MDP0)                                    \
+  MEMORY_KERNELS_GRAN(acc, op, MDP1)
+
+#define MEMORY_KERNELS_OP(acc)                                          \
+  MEMORY_KERNELS_META(acc, NONE)                                        \
+  MEMORY_KERNELS_META(acc, READ)                                        \
+  MEMORY_KERNELS_META(acc, WRITE)
+
+MEMORY_KERNELS_OP(SEQ)
+MEMORY_KERNELS_OP(RND)
+MEMORY_KERNELS_OP(RNDU)
+
+#define MEMORY_KERNEL_TABLE_GRAN(acc, op, meta)                         \
+  {                                                                     \
+    event_##acc##_##op##_##meta##_WORD,                                 \
+    event_##acc##_##op##_##meta##_PAGE,                                 \
+    event_##acc##_##op##_##meta##_EVENT                                 \
+  }
+
+#define MEMORY_KERNEL_TABLE_META(acc, op)                               \
+  {                                                                     \
+    MEMORY_KERNEL_TABLE_GRAN(acc, op, OFF),                             \
+    MEMORY_KERNEL_TABLE_GRAN(acc, op, MDP0),                            \
+    MEMORY_KERNEL_TABLE_GRAN(acc, op, MDP1)                             \
+  }
+
+#define MEMORY_KERNEL_TABLE_OP(acc)                                     \
+  {                                                                     \
+    MEMORY_KERNEL_TABLE_META(acc, NONE),                                \
+    MEMORY_KERNEL_TABLE_META(acc, READ),                                \
+    MEMORY_KERNEL_TABLE_META(acc, WRITE)                                \
+  }
+
+/* Kernels indexed by [access mode][operation][PTE metadata mode][granularity] */
+static sb_op_execute_event * const memory_kernels[3][3][3][3] =
+{
+  MEMORY_KERNEL_TABLE_OP(SEQ),
+  MEMORY_KERNEL_TABLE_OP(RND),
+  MEMORY_KERNEL_TABLE_OP(RNDU)
+};
+
+void memory_print_mode(void)
+{
+  char *str;
+
+  log_text(LOG_NOTICE, "Running memory speed test with the following options:");
+  log_text(LOG_NOTICE, "  block size: %ldKiB",
+           (long)(memory_block_size / 1024));
+  log_text(LOG_NOTICE, "  total size: %ldMiB",
+           (long)(memory_total_size / 1024 / 1024));
+  if (memory_ws_blocks > 1)
+    log_text(LOG_NOTICE, "  working set: %ldMiB (%zu blocks)",
+             (long)(memory_working_set / 1024 / 1024), memory_ws_blocks);
+  if (memory_page_backend != SB_MEM_PAGE_4K)
+    log_text(LOG_NOTICE, "  page backend: %s",
+             memory_page_backend_names[memory_page_backend]);
+
+  switch (memory_oper) {
+    case SB_MEM_OP_READ:
+      str = "read";
+      break;
+    case SB_MEM_OP_WRITE:
+      str = "write";
+      break;
+    case SB_MEM_OP_NONE:
+      str = "none";
+      break;
+    default:
+      str = "(unknown)";
+      break;
+  }
+  log_text(LOG_NOTICE, "  operation: %s", str);
+
+  switch (memory_scope) {
+    case SB_MEM_SCOPE_GLOBAL:
+      str = "global";
+      break;
+    case SB_MEM_SCOPE_LOCAL:
+      str = "local";
+      break;
+    default:
+      str = "(unknown)";
+      break;
+  }
+  log_text(LOG_NOTICE, "  scope: %s", str);
+
+  if (pte_meta_enabled) {
+    static const char * const gran_names[] = { "word", "page", "event" };
+
+    log_text(LOG_NOTICE, "  PTE metadata: enabled (type=%d, backend=%s, "
+             "granularity=%s, batch=%u, read cache=%s, async=%s)",
+             pte_meta_type, pte_meta_backend_name(pte_meta_backend_type),
+             gran_names[pte_meta_granularity], pte_meta_batch,
+             pte_meta_read_cache ? "on" : "off",
+             pte_meta_async ? "on" : "off");
+    if (pte_meta_sharing != SB_MEM_PTE_SHARE_SCOPE)
+      log_text(LOG_NOTICE, "  PTE metadata sharing: %s",
+               pte_meta_sharing_names[pte_meta_sharing]);
+    if (pte_meta_evict_method != PTE_META_EVICT_NONE)
+      log_text(LOG_NOTICE, "  PTE metadata eviction: %s (every other "
+               "operation)", pte_meta_evict_name(pte_meta_evict_method));
+    if (pte_meta_validate)
+      log_text(LOG_NOTICE, "  PTE metadata validation: on (%u verifier "
+               "threads)", pte_meta_validate_threads);
+  } else {
+    log_text(LOG_NOTICE, "  PTE metadata: disabled");
+  }
+
+  if (memory_perf_nevents > 0)
+  {
+    char   buf[512];
+    size_t len = 0;
+
+    buf[0] = '\0';
+    for (unsigned i = 0; i < memory_perf_nevents && len < sizeof(buf); i++)
+      len += snprintf(buf + len, sizeof(buf) - len, "%s%s", i > 0 ? "," : "",
+                      memory_perf_events[i].name);
+    log_text(LOG_NOTICE, "  perf events: %s%s", buf,
+             memory_perf_user_only ? " (user space only)" : "");
+  }
+
+  log_text(LOG_NOTICE, "");
+}
+
+/*
+  Print intermediate test statistics.
+*/
+
+void memory_report_intermediate(sb_stat_t *stat)
+{
+  const double megabyte = 1024.0 * 1024.0;
+  char         perf[1024];
+  size_t       len = 0;
+
+  perf[0] = '\0';
+  if (memory_perf_nevents > 0)
+  {
+    double totals[SB_MEM_PERF_MAX_EVENTS];
+
+    memory_perf_read(totals);
+    for (unsigned i = 0; i < memory_perf_nevents && len < sizeof(perf); i++)
+    {
+      const double delta = totals[i] - memory_perf_last[i];
+
+      len += snprintf(perf + len, sizeof(perf) - len,
+                      ", %s/s: %.0f, %s/event: %.2f",
+                      memory_perf_events[i].name, delta / stat->time_interval,
+                      memory_perf_events[i].name,
+                      stat->events > 0 ? delta / stat->events : 0.0);
+      memory_perf_last[i] = totals[i];
+    }
+  }
+
+  log_timestamp(LOG_NOTICE, stat->time_total, "%4.2f MiB/sec%s",
+                stat->events * memory_block_size / megabyte /
+                stat->time_interval, perf);
+}
+
+/*
+  Print cumulative test statistics.
+*/
+
+/*
+  Sum the PTE metadata counters of all threads and store their increments
+  since the previous call in delta.
+*/
+static void pte_meta_get_totals(memory_pte_totals_t *delta)
+{
+  memory_pte_totals_t cur = { 0 };
+
+  for (unsigned i = 0; i < sb_globals.threads; i++)
+  {
+    const memory_pte_thread_t * const t = &pte_threads[i];
+
+    cur.ops += t->ops;
+    cur.calls += t->calls;
+    cur.batches += t->batches;
+    cur.cache_hits += t->cache_hits;
+    cur.cache_misses += t->cache_misses;
+    cur.cache_sets += t->cache_sets;
+    cur.cache_stale += t->cache_stale;
+    cur.queued += t->queued;
+    cur.depth_sum += t->depth_sum;
+    cur.ring_full += t->ring_full;
+  }
+
+  for (unsigned i = 0; pte_drainers != NULL && i < pte_meta_async_drainers; i++)
+  {
+    const memory_pte_drainer_t * const d = &pte_drainers[i];
+
+    cur.drained += d->drained;
+    cur.drain_calls += d->calls;
+    cur.lag_sum += d->lag_sum;
+    cur.vis_sum += d->vis_sum;
+  }
+
+#define SB_PTE_DELTA(f) delta->f = cur.f - pte_report_last.f
+  SB_PTE_DELTA(ops);
+  SB_PTE_DELTA(calls);
+  SB_PTE_DELTA(batches);
+  SB_PTE_DELTA(cache_hits);
+  SB_PTE_DELTA(cache_misses);
+  SB_PTE_DELTA(cache_sets);
+  SB_PTE_DELTA(cache_stale);
+  SB_PTE_DELTA(queued);
+  SB_PTE_DELTA(depth_sum);
+  SB_PTE_DELTA(ring_full);
+  SB_PTE_DELTA(drained);
+  SB_PTE_DELTA(drain_calls);
+  SB_PTE_DELTA(lag_sum);
+  SB_PTE_DELTA(vis_sum);
+#undef SB_PTE_DELTA
+
+  pte_report_last = cur;
+}
+
+void memory_report_cumulative(sb_stat_t *stat)
+{
+  const double megabyte = 1024.0 * 1024.0;
+  memory_pte_totals_t pte = { 0 };
+
+  if (pte_meta_enabled)
+    pte_meta_get_totals(&pte);
+
+  log_text(LOG_NOTICE, "Total operations: %" PRIu64 " (%8.2f per second)\n",
+           stat->events, stat->events / stat->time_interval);
+
+  if (memory_oper != SB_MEM_OP_NONE)
+  {
+    const double mb = stat->events * memory_block_size / megabyte;
+    log_text(LOG_NOTICE, "%4.2f MiB transferred (%4.2f MiB/sec)\n",
+             mb, mb / stat->time_interval);
+  }
+
+  if (pte_meta_enabled)
+    log_text(LOG_NOTICE, "PTE metadata enable: %lu PMDs expanded in %.3f ms "
+             "(%.2f us per PMD)\n", pte_enable_stats.pmds,
+             pte_enable_stats.ns / 1e6, pte_enable_stats.pmds > 0 ?
+             pte_enable_stats.ns / 1e3 / pte_enable_stats.pmds : 0.0);
+
+  if (memory_page_backend != SB_MEM_PAGE_4K)
+    memory_report_page_backend();
+
+  if (pte_meta_enabled && memory_oper != SB_MEM_OP_NONE)
   {
-    size_t offset = (size_t) sb_rand_default(0, max_offset);
-    
-    /* Call set_pte_meta syscall for each write operation */
-    if (pte_meta_enabled) {
-      unsigned long addr = (unsigned long)(buffers[tid] + offset);
-      if (pte_meta_type == 0) {
-        /* MDP=0: Direct u64 metadata */
-        uint64_t meta_val = (uint64_t)i; /* Use loop counter as metadata */
-        if (set_pte_meta_direct(addr, meta_val) != 0) {
-          log_text(LOG_DEBUG, "set_pte_meta_direct failed for addr %lx", addr);
-        }
-      } else {
-        /* MDP=1: Structured metadata */
-        uint64_t payload_data = (uint64_t)i;
-        if (set_pte_meta_structured(addr, 1, 0x1234, &payload_data, sizeof(payload_data)) != 0) {
-          log_text(LOG_DEBUG, "set_pte_meta_structured failed for addr %lx", addr);
-        }
-      }
+    log_text(LOG_NOTICE, "PTE metadata %s: %" PRIu64 " (%.2f per "
+             "event, %8.2f per second)\n",
+             memory_oper == SB_MEM_OP_WRITE ? "updates" : "lookups", pte.ops,
+             stat->events > 0 ? (double) pte.ops / stat->events : 0.0,
+             pte.ops / stat->time_interval);
+
+    if (pte_meta_read_cache && memory_oper == SB_MEM_OP_READ)
+    {
+      const uint64_t lookups = pte.cache_hits + pte.cache_misses;
+
+      log_text(LOG_NOTICE, "PTE metadata read cache: %" PRIu64 " hits, %"
+               PRIu64 " misses (%.2f%% hit ratio)%s", pte.cache_hits,
+               pte.cache_misses,
+               lookups > 0 ? 100.0 * pte.cache_hits / lookups : 0.0,
+               pte_meta_cache_sets > 0 ? "" : "\n");
+      if (pte_meta_cache_sets > 0)
+        log_text(LOG_NOTICE, "    %" PRIu64 " sets from the lookup path, %"
+                 PRIu64 " stale hits after a set\n", pte.cache_sets,
+                 pte.cache_stale);
     }
-    
-    SIZE_T_STORE(buffers[tid] + offset, i);
+
+    if (pte_meta_batch > 1 && pte_rings == NULL)
+      log_text(LOG_NOTICE, "PTE metadata batches: %" PRIu64 " of up to %u "
+               "operations, %" PRIu64 " calls (%.2f per batch)\n",
+               pte.batches, pte_meta_batch, pte.calls,
+               pte.batches > 0 ? (double) pte.calls / pte.batches : 0.0);
   }
 
-  return 0;
-}
+  if (pte_rings != NULL)
+  {
+    uint64_t lag_max = 0, vis_max = 0;
+    unsigned int depth_max = 0;
 
+    for (unsigned i = 0; i < sb_globals.threads; i++)
+      depth_max = SB_MAX(depth_max, pte_threads[i].depth_max);
 
-int event_seq_none(sb_event_t *req, int tid)
-{
-  (void) req; /* unused */
+    for (unsigned i = 0; i < pte_meta_async_drainers; i++)
+    {
+      lag_max = SB_MAX(lag_max, pte_drainers[i].lag_max);
+      vis_max = SB_MAX(vis_max, pte_drainers[i].vis_max);
+    }
+
+    log_text(LOG_NOTICE, "PTE metadata async: %u drainer threads, %" PRIu64
+             " updates queued, %" PRIu64 " drained in %" PRIu64 " calls",
+             pte_meta_async_drainers, pte.queued, pte.drained,
+             pte.drain_calls);
+    log_text(LOG_NOTICE, "    queue depth (avg/max):           %.2f/%u "
+             "(%" PRIu64 " enqueue retries on a full ring)",
+             pte.queued > 0 ? (double) pte.depth_sum / pte.queued : 0.0,
+             depth_max, pte.ring_full);
+    log_text(LOG_NOTICE, "    drain lag (avg/%uth/max, us):    %.2f/%.2f/%.2f",
+             sb_globals.percentile,
+             pte.drained > 0 ? pte.lag_sum / 1e3 / pte.drained : 0.0,
+             sb_histogram_get_pct_cumulative(&pte_lag_hist,
+                                             sb_globals.percentile),
+             lag_max / 1e3);
+    log_text(LOG_NOTICE, "    visibility (avg/%uth/max, us):   %.2f/%.2f/%.2f\n",
+             sb_globals.percentile,
+             pte.drained > 0 ? pte.vis_sum / 1e3 / pte.drained : 0.0,
+             sb_histogram_get_pct_cumulative(&pte_vis_hist,
+                                             sb_globals.percentile),
+             vis_max / 1e3);
+  }
 
-  for (size_t *buf = buffers[tid], *end = buf + max_offset; buf <= end; buf++)
+  if (pte_op_hists != NULL)
   {
-    ck_pr_barrier();
-    /* nop */
+    log_text(LOG_NOTICE, "PTE metadata %s latency per thread "
+             "(50th/%uth/99th/max, us):",
+             pte_meta_sharing_names[pte_meta_sharing], sb_globals.percentile);
+    for (unsigned i = 0; i < sb_globals.threads; i++)
+      log_text(LOG_NOTICE, "    thread %3u: %8.3f/%8.3f/%8.3f/%8.3f "
+               "(%" PRIu64 " operations)", i,
+               sb_histogram_get_pct_cumulative(&pte_op_hists[i], 50),
+               sb_histogram_get_pct_cumulative(&pte_op_hists[i],
+                                               sb_globals.percentile),
+               sb_histogram_get_pct_cumulative(&pte_op_hists[i], 99),
+               sb_histogram_get_pct_cumulative(&pte_op_hists[i], 100),
+               pte_threads[i].calls);
+    log_text(LOG_NOTICE, "");
   }
 
-  return 0;
-}
+  if (pte_meta_evict_method != PTE_META_EVICT_NONE)
+  {
+    uint64_t calls = 0, cold = 0;
 
+    for (unsigned i = 0; i < sb_globals.threads; i++)
+    {
+      calls += pte_threads[i].calls;
+      /* Calls are counted from 1 and the odd-numbered ones are cold */
+      cold += (pte_threads[i].calls + 1) / 2;
+    }
 
-int event_seq_read(sb_event_t *req, int tid)
-{
-  (void) req; /* unused */
+    log_text(LOG_NOTICE, "PTE metadata warm/cold latency, %s eviction "
+             "(50th/%uth/99th/max, us):",
+             pte_meta_evict_name(pte_meta_evict_method), sb_globals.percentile);
+    log_text(LOG_NOTICE, "    warm: %8.3f/%8.3f/%8.3f/%8.3f (%" PRIu64
+             " operations)",
+             sb_histogram_get_pct_cumulative(&pte_warm_hist, 50),
+             sb_histogram_get_pct_cumulative(&pte_warm_hist,
+                                             sb_globals.percentile),
+             sb_histogram_get_pct_cumulative(&pte_warm_hist, 99),
+             sb_histogram_get_pct_cumulative(&pte_warm_hist, 100),
+             calls - cold);
+    log_text(LOG_NOTICE, "    cold: %8.3f/%8.3f/%8.3f/%8.3f (%" PRIu64
+             " operations)\n",
+             sb_histogram_get_pct_cumulative(&pte_cold_hist, 50),
+             sb_histogram_get_pct_cumulative(&pte_cold_hist,
+                                             sb_globals.percentile),
+             sb_histogram_get_pct_cumulative(&pte_cold_hist, 99),
+             sb_histogram_get_pct_cumulative(&pte_cold_hist, 100),
+             cold);
+  }
 
-  for (size_t *buf = buffers[tid], *end = buf + max_offset; buf < end; buf++)
+  if (memory_perf_nevents > 0)
   {
-    /* Call get_pte_meta syscall for each read operation */
-    if (pte_meta_enabled) {
-      unsigned long addr = (unsigned long)buf;
-      if (pte_meta_type == 0) {
-        uint64_t meta_result;
-        int ret = get_pte_meta(addr, &meta_result);
-        (void) ret; (void) meta_result; /* Store result to prevent optimization */
-      } else {
-        /* For MDP=1, allocate buffer for structured metadata */
-        uint8_t meta_buffer[sizeof(struct metadata_header) + 64]; /* Header + some payload space */
-        int ret = get_pte_meta(addr, meta_buffer);
-        (void) ret; /* Store result to prevent optimization */
-      }
+    double totals[SB_MEM_PERF_MAX_EVENTS];
+    double counted = memory_perf_read(totals);
+
+    log_text(LOG_NOTICE, "Performance counters (summed over %u threads%s):",
+             sb_globals.threads,
+             memory_perf_user_only ? ", user space only" : "");
+    for (unsigned i = 0; i < memory_perf_nevents; i++)
+    {
+      /* Counters run from the start, report this interval's share */
+      const double delta = totals[i] - memory_perf_last_cumulative[i];
+
+      memory_perf_last_cumulative[i] = totals[i];
+      log_text(LOG_NOTICE, "    %-24s %18.0f (%16.2f per second, %12.2f "
+               "per event)%s", memory_perf_events[i].name, delta,
+               delta / stat->time_interval,
+               stat->events > 0 ? delta / stat->events : 0.0,
+               i + 1 == memory_perf_nevents && counted >= 1.0 ? "\n" : "");
     }
-    
-    size_t val = SIZE_T_LOAD(buf);
-    (void) val; /* unused */
+    if (counted < 1.0)
+      log_text(LOG_NOTICE, "    counters were multiplexed and ran %.1f%% of "
+               "the time, counts are scaled\n", counted * 100);
   }
 
-  return 0;
+  if (pte_meta_enabled && pte_meta_backend_type == PTE_META_BACKEND_EMUL)
+  {
+    const unsigned long expanded = pte_meta_emul_expanded();
+
+    log_text(LOG_NOTICE, "PTE metadata emulation: %lu PTE pages expanded "
+             "(%lu KiB of metadata)\n", expanded,
+             expanded * PTE_META_PTRS_PER_PTE * sizeof(uint64_t) / 1024);
+  }
+
+  sb_report_cumulative(stat);
 }
 
-int event_seq_write(sb_event_t *req, int tid)
+/*
+  Check the metadata of page idx of buffer b. The final value of a page must
+  come from the last write to it of the thread that wrote it last, so it has
+  to match that thread's recorded event for the page. In a global buffer a
+  lost update can only be seen when the value left behind is not the last
+  write of its own thread, local buffers are checked exactly.
+*/
+static void pte_meta_verify_page(memory_pte_verifier_t *v, unsigned int b,
+                                 size_t idx)
 {
-  (void) req; /* unused */
+  const unsigned long addr = (unsigned long) buffers[b] +
+    idx * memory_page_size;
+  /* Only the owner writes a local buffer, all threads write a global one */
+  const unsigned int first = memory_scope == SB_MEM_SCOPE_GLOBAL ? 0 : b;
+  const unsigned int nwriters = memory_scope == SB_MEM_SCOPE_GLOBAL ?
+    sb_globals.threads : 1;
+  unsigned char buf[SB_MEM_PTE_GET_BUF_SIZE];
+  uint64_t value = 0;
+  unsigned int writer;
+  const char *what;
+  int written = 0;
+
+  for (unsigned i = first; i < first + nwriters; i++)
+    if (pte_threads[i].val_last[idx] != 0)
+      written = 1;
+
+  /* An MDP=1 lookup of a page never set returns the bare 0 u64 */
+  memset(buf, 0, sizeof(buf));
+  if (get_pte_meta(addr, buf) == 0)
+  {
+    if (pte_meta_type == 0)
+      memcpy(&value, buf, sizeof(value));
+    else if (((struct metadata_header *) buf)->length >= sizeof(value))
+      memcpy(&value, buf + sizeof(struct metadata_header), sizeof(value));
+  }
 
-  size_t counter = 0;
-  for (size_t *buf = buffers[tid], *end = buf + max_offset; buf < end; buf++, counter++)
+  v->checked++;
+
+  writer = (unsigned int) (value >> (2 * SB_MEM_PTE_VAL_BITS)) - 1;
+
+  if (value == 0)
   {
-    /* Call set_pte_meta syscall for each write operation */
-    if (pte_meta_enabled) {
-      unsigned long addr = (unsigned long)buf;
-      if (pte_meta_type == 0) {
-        /* MDP=0: Direct u64 metadata */
-        uint64_t meta_val = (uint64_t)counter; /* Use counter as metadata */
-        if (set_pte_meta_direct(addr, meta_val) != 0) {
-          log_text(LOG_DEBUG, "set_pte_meta_direct failed for addr %lx", addr);
-        }
-      } else {
-        /* MDP=1: Structured metadata */
-        uint64_t payload_data = (uint64_t)counter;
-        if (set_pte_meta_structured(addr, 1, 0x1234, &payload_data, sizeof(payload_data)) != 0) {
-          log_text(LOG_DEBUG, "set_pte_meta_structured failed for addr %lx", addr);
-        }
-      }
-    }
-    
-    SIZE_T_STORE(buf, (size_t) tid);
+    if (!written)
+      return;
+    v->missing++;
+    what = "missing";
+  }
+  else if (writer < first || writer >= first + nwriters ||
+           ((value >> SB_MEM_PTE_VAL_BITS) & SB_MEM_PTE_VAL_MASK) !=
+           (idx & SB_MEM_PTE_VAL_MASK) ||
+           pte_threads[writer].val_last[idx] == 0)
+  {
+    v->corrupt++;
+    what = "corrupt";
   }
+  else if ((value & SB_MEM_PTE_VAL_MASK) != pte_threads[writer].val_last[idx])
+  {
+    v->stale++;
+    what = "stale";
+  }
+  else
+    return;
 
-  return 0;
+  if (v->missing + v->stale + v->corrupt == 1)
+    log_text(LOG_WARNING, "PTE metadata validation: %s metadata 0x%" PRIx64
+             " for page %zu of buffer %u", what, value, idx, b);
 }
 
+static void *pte_meta_verifier_proc(void *arg)
+{
+  memory_pte_verifier_t * const v = arg;
 
-void memory_print_mode(void)
+  for (size_t i = v->first; i < v->last; i++)
+    pte_meta_verify_page(v, i / pte_meta_val_pages, i % pte_meta_val_pages);
+
+  return NULL;
+}
+
+/*
+  Shard the pages of all buffers across the verifier threads and report
+  mismatches. Any mismatch fails the run.
+*/
+static void pte_meta_validate_run(void)
 {
-  char *str;
+  const unsigned int nbufs = memory_scope == SB_MEM_SCOPE_GLOBAL ?
+    1 : sb_globals.threads;
+  const size_t total = nbufs * pte_meta_val_pages;
+  const unsigned int n = SB_MIN(pte_meta_validate_threads, total);
+  memory_pte_verifier_t *verifiers;
+  uint64_t checked = 0, missing = 0, stale = 0, corrupt = 0, start, ns;
+  unsigned int started;
+
+  verifiers = sb_memalign(n * sizeof(memory_pte_verifier_t), CK_MD_CACHELINE);
+  if (verifiers == NULL)
+  {
+    log_text(LOG_FATAL, "Failed to allocate PTE metadata verifiers!");
+    sb_globals.error = 1;
+    return;
+  }
+  memset(verifiers, 0, n * sizeof(memory_pte_verifier_t));
 
-  log_text(LOG_NOTICE, "Running memory speed test with the following options:");
-  log_text(LOG_NOTICE, "  block size: %ldKiB",
-           (long)(memory_block_size / 1024));
-  log_text(LOG_NOTICE, "  total size: %ldMiB",
-           (long)(memory_total_size / 1024 / 1024));
+  start = pte_meta_now_ns();
 
-  switch (memory_oper) {
-    case SB_MEM_OP_READ:
-      str = "read";
-      break;
-    case SB_MEM_OP_WRITE:
-      str = "write";
-      break;
-    case SB_MEM_OP_NONE:
-      str = "none";
-      break;
-    default:
-      str = "(unknown)";
+  for (started = 0; started < n; started++)
+  {
+    memory_pte_verifier_t * const v = &verifiers[started];
+
+    v->first = total * started / n;
+    v->last = total * (started + 1) / n;
+    if (sb_thread_create(&v->thread, NULL, pte_meta_verifier_proc, v) != 0)
+    {
+      log_errno(LOG_WARNING, "Failed to create PTE metadata verifier thread");
       break;
+    }
   }
-  log_text(LOG_NOTICE, "  operation: %s", str);
 
-  switch (memory_scope) {
-    case SB_MEM_SCOPE_GLOBAL:
-      str = "global";
-      break;
-    case SB_MEM_SCOPE_LOCAL:
-      str = "local";
-      break;
-    default:
-      str = "(unknown)";
-      break;
+  /* Verify whatever the missing threads would have checked inline */
+  if (started < n)
+  {
+    verifiers[started].last = total;
+    pte_meta_verifier_proc(&verifiers[started]);
   }
-  log_text(LOG_NOTICE, "  scope: %s", str);
 
-  if (pte_meta_enabled) {
-    log_text(LOG_NOTICE, "  PTE metadata: enabled (type=%d)", pte_meta_type);
-  } else {
-    log_text(LOG_NOTICE, "  PTE metadata: disabled");
+  for (unsigned i = 0; i < n; i++)
+  {
+    if (i < started && sb_thread_join(verifiers[i].thread, NULL))
+      log_errno(LOG_WARNING, "Failed to join PTE metadata verifier thread");
+
+    checked += verifiers[i].checked;
+    missing += verifiers[i].missing;
+    stale += verifiers[i].stale;
+    corrupt += verifiers[i].corrupt;
   }
 
-  log_text(LOG_NOTICE, "");
+  ns = pte_meta_now_ns() - start;
+
+  log_text(LOG_NOTICE, "PTE metadata validation: %" PRIu64 " pages checked "
+           "by %u threads in %.3f ms (%.0f pages/sec)", checked, started,
+           ns / 1e6, ns > 0 ? checked * 1e9 / ns : 0.0);
+  log_text(LOG_NOTICE, "    mismatches: %" PRIu64 " (%" PRIu64 " missing, %"
+           PRIu64 " stale, %" PRIu64 " corrupt)\n", missing + stale + corrupt,
+           missing, stale, corrupt);
+
+  if (missing + stale + corrupt > 0)
+  {
+    log_text(LOG_FATAL, "PTE metadata validation failed!");
+    sb_globals.error = 1;
+  }
+
+  free(verifiers);
+
+  for (unsigned i = 0; i < sb_globals.threads; i++)
+  {
+    free(pte_threads[i].val_last);
+    pte_threads[i].val_last = NULL;
+  }
+}
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+
+#define SB_MEM_PERF_HW_CACHE(cache, op, result)                 \
+  (PERF_COUNT_HW_CACHE_ ## cache |                              \
+   (PERF_COUNT_HW_CACHE_OP_ ## op << 8) |                       \
+   (PERF_COUNT_HW_CACHE_RESULT_ ## result << 16))
+
+/* Counters known by name, the same names as perf-list(1) */
+static const memory_perf_event_t memory_perf_known[] =
+{
+  { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+  { "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { "branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+  { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  { "L1-dcache-loads", PERF_TYPE_HW_CACHE,
+    SB_MEM_PERF_HW_CACHE(L1D, READ, ACCESS) },
+  { "L1-dcache-load-misses", PERF_TYPE_HW_CACHE,
+    SB_MEM_PERF_HW_CACHE(L1D, READ, MISS) },
+  { "LLC-loads", PERF_TYPE_HW_CACHE, SB_MEM_PERF_HW_CACHE(LL, READ, ACCESS) },
+  { "LLC-load-misses", PERF_TYPE_HW_CACHE,
+    SB_MEM_PERF_HW_CACHE(LL, READ, MISS) },
+  { "dTLB-loads", PERF_TYPE_HW_CACHE,
+    SB_MEM_PERF_HW_CACHE(DTLB, READ, ACCESS) },
+  { "dTLB-load-misses", PERF_TYPE_HW_CACHE,
+    SB_MEM_PERF_HW_CACHE(DTLB, READ, MISS) },
+  { "dTLB-stores", PERF_TYPE_HW_CACHE,
+    SB_MEM_PERF_HW_CACHE(DTLB, WRITE, ACCESS) },
+  { "dTLB-store-misses", PERF_TYPE_HW_CACHE,
+    SB_MEM_PERF_HW_CACHE(DTLB, WRITE, MISS) },
+  { "iTLB-load-misses", PERF_TYPE_HW_CACHE,
+    SB_MEM_PERF_HW_CACHE(ITLB, READ, MISS) },
+  { "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+  { "minor-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN },
+  { "major-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ },
+  { "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+  { "cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+  { "task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+  { "cpu-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK }
+};
+
+/* Used in place of the hardware counters when the PMU is not available */
+static const char * const memory_perf_fallback[] =
+  { "page-faults", "context-switches", "task-clock" };
+
+/* Look up a counter by name, rNNNN is a raw hardware event in hex */
+static int memory_perf_lookup(const char *name, memory_perf_event_t *ev)
+{
+  const size_t nknown = sizeof(memory_perf_known) / sizeof(memory_perf_known[0]);
+  char         *end;
+
+  for (size_t i = 0; i < nknown; i++)
+  {
+    if (!strcmp(name, memory_perf_known[i].name))
+    {
+      *ev = memory_perf_known[i];
+      return 0;
+    }
+  }
+
+  if (name[0] == 'r' && name[1] != '\0')
+  {
+    ev->name = name;
+    ev->type = PERF_TYPE_RAW;
+    ev->config = strtoull(name + 1, &end, 16);
+    if (*end == '\0')
+      return 0;
+  }
+
+  return 1;
+}
+
+/* Open a counter for the calling thread, returns the fd or -1 */
+static int memory_perf_open(const memory_perf_event_t *ev, int group_fd)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = ev->type;
+  attr.config = ev->config;
+  attr.disabled = group_fd == -1;
+  attr.exclude_kernel = memory_perf_user_only;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+    PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group_fd,
+                       PERF_FLAG_FD_CLOEXEC);
 }
 
 /*
-  Print intermediate test statistics.
+  Parse --memory-perf-events and probe each counter from the main thread.
+  Hardware counters that cannot be opened (no PMU, e.g. in most VMs) are
+  replaced with software counters.
 */
+static int memory_perf_init(void)
+{
+  memory_perf_event_t ev;
+  sb_list_item_t      *pos;
+  unsigned int        n = 0, dropped = 0;
+  int                 fd, err = 0;
 
-void memory_report_intermediate(sb_stat_t *stat)
+  SB_LIST_FOR_EACH(pos, sb_get_value_list("memory-perf-events"))
+  {
+    const char *name = SB_LIST_ENTRY(pos, value_t, listitem)->data;
+
+    if (memory_perf_lookup(name, &ev) != 0)
+    {
+      log_text(LOG_FATAL, "Invalid value for memory-perf-events: %s", name);
+      return 1;
+    }
+    if (n == SB_MEM_PERF_MAX_EVENTS)
+    {
+      log_text(LOG_FATAL, "--memory-perf-events supports at most %u "
+               "counters", SB_MEM_PERF_MAX_EVENTS);
+      return 1;
+    }
+
+    /* Kernel time is part of what is measured, count it when allowed */
+    fd = memory_perf_open(&ev, -1);
+    if (fd < 0 && (errno == EACCES || errno == EPERM) && !memory_perf_user_only)
+    {
+      memory_perf_user_only = 1;
+      fd = memory_perf_open(&ev, -1);
+    }
+    if (fd < 0)
+    {
+      err = errno;
+      if (ev.type == PERF_TYPE_SOFTWARE)
+        log_errno(LOG_WARNING, "Cannot open performance counter %s, ignored",
+                  name);
+      else
+        dropped++;
+      continue;
+    }
+    close(fd);
+    memory_perf_events[n++] = ev;
+  }
+
+  if (dropped > 0)
+  {
+    const size_t nfallback =
+      sizeof(memory_perf_fallback) / sizeof(memory_perf_fallback[0]);
+
+    log_text(LOG_WARNING, "%u hardware performance counters are unavailable "
+             "(%s), collecting software counters instead", dropped,
+             strerror(err));
+
+    for (size_t i = 0; i < nfallback && n < SB_MEM_PERF_MAX_EVENTS; i++)
+    {
+      unsigned int j;
+
+      for (j = 0; j < n; j++)
+        if (!strcmp(memory_perf_events[j].name, memory_perf_fallback[i]))
+          break;
+      if (j < n || memory_perf_lookup(memory_perf_fallback[i], &ev) != 0 ||
+          (fd = memory_perf_open(&ev, -1)) < 0)
+        continue;
+      close(fd);
+      memory_perf_events[n++] = ev;
+    }
+  }
+
+  memory_perf_nevents = n;
+  if (n == 0)
+    return 0;
+
+  memory_perf_threads =
+    sb_alloc_per_thread_array(sizeof(memory_perf_thread_t));
+  if (memory_perf_threads == NULL)
+  {
+    log_text(LOG_FATAL, "Failed to allocate performance counter state!");
+    return 1;
+  }
+  for (unsigned i = 0; i < sb_globals.threads; i++)
+    for (unsigned j = 0; j < SB_MEM_PERF_MAX_EVENTS; j++)
+      memory_perf_threads[i].fds[j] = -1;
+
+  return 0;
+}
+
+/* Open and start the counter group of the calling worker thread */
+static void memory_perf_thread_init(int thread_id)
 {
-  const double megabyte = 1024.0 * 1024.0;
+  int * const fds = memory_perf_threads[thread_id].fds;
 
-  log_timestamp(LOG_NOTICE, stat->time_total, "%4.2f MiB/sec",
-                stat->events * memory_block_size / megabyte /
-                stat->time_interval);
+  for (unsigned i = 0; i < memory_perf_nevents; i++)
+  {
+    fds[i] = memory_perf_open(&memory_perf_events[i], i > 0 ? fds[0] : -1);
+    if (fds[i] < 0)
+    {
+      log_errno(LOG_WARNING, "Cannot open performance counter %s for thread "
+                "#%d, thread not counted", memory_perf_events[i].name,
+                thread_id);
+      for (unsigned j = 0; j < i; j++)
+        close(fds[j]);
+      fds[0] = -1;
+      return;
+    }
+  }
+
+  ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
 }
 
 /*
-  Print cumulative test statistics.
+  Sum the counters of all worker groups into totals, each scaled up when its
+  group was multiplexed. Returns the fraction of time the groups were counting.
+  Groups of threads that have exited still return their final counts.
 */
+static double memory_perf_read(double *totals)
+{
+  uint64_t buf[3 + SB_MEM_PERF_MAX_EVENTS];
+  double   enabled = 0, running = 0;
 
-void memory_report_cumulative(sb_stat_t *stat)
+  for (unsigned i = 0; i < memory_perf_nevents; i++)
+    totals[i] = 0;
+
+  for (unsigned t = 0; t < sb_globals.threads; t++)
+  {
+    const int fd = memory_perf_threads[t].fds[0];
+    double    scale;
+
+    /* { nr, time_enabled, time_running, values[nr] } */
+    if (fd < 0 || read(fd, buf, sizeof(buf)) <
+        (ssize_t) ((3 + memory_perf_nevents) * sizeof(uint64_t)) ||
+        buf[0] != memory_perf_nevents || buf[2] == 0)
+      continue;
+
+    enabled += buf[1];
+    running += buf[2];
+    scale = (double) buf[1] / buf[2];
+    for (unsigned i = 0; i < memory_perf_nevents; i++)
+      totals[i] += buf[3 + i] * scale;
+  }
+
+  return enabled > 0 ? running / enabled : 1.0;
+}
+
+static void memory_perf_done(void)
 {
-  const double megabyte = 1024.0 * 1024.0;
+  if (memory_perf_threads == NULL)
+    return;
 
-  log_text(LOG_NOTICE, "Total operations: %" PRIu64 " (%8.2f per second)\n",
-           stat->events, stat->events / stat->time_interval);
+  for (unsigned t = 0; t < sb_globals.threads; t++)
+    for (unsigned i = 0; i < memory_perf_nevents; i++)
+      if (memory_perf_threads[t].fds[i] >= 0)
+        close(memory_perf_threads[t].fds[i]);
 
-  if (memory_oper != SB_MEM_OP_NONE)
+  free(memory_perf_threads);
+  memory_perf_threads = NULL;
+  memory_perf_nevents = 0;
+}
+
+#else /* !HAVE_LINUX_PERF_EVENT_H */
+
+static int memory_perf_init(void)
+{
+  if (!SB_LIST_IS_EMPTY(sb_get_value_list("memory-perf-events")))
   {
-    const double mb = stat->events * memory_block_size / megabyte;
-    log_text(LOG_NOTICE, "%4.2f MiB transferred (%4.2f MiB/sec)\n",
-             mb, mb / stat->time_interval);
+    log_text(LOG_FATAL, "--memory-perf-events is not supported on this "
+             "platform");
+    return 1;
   }
+  return 0;
+}
 
-  sb_report_cumulative(stat);
+static void memory_perf_thread_init(int thread_id)
+{
+  (void) thread_id;
 }
 
-#ifdef HAVE_LARGE_PAGES
+static void memory_perf_done(void)
+{
+}
 
-/* Allocate memory from HugeTLB pool */
+static double memory_perf_read(double *totals)
+{
+  (void) totals;
+  return 1.0;
+}
 
-void * hugetlb_alloc(size_t size)
+#endif /* HAVE_LINUX_PERF_EVENT_H */
+
+/* Return the value of a "Field: value kB" line of a /proc file, or -1 */
+static long memory_proc_field(const char *path, const char *field)
 {
-  int shmid;
-  void *ptr;
-  struct shmid_ds buf;
+  FILE   *fp;
+  char   line[256];
+  long   val = -1;
+  size_t len = strlen(field);
 
-  /* Align block size to my_large_page_size */
-  size = ((size - 1) & ~LARGE_PAGE_SIZE) + LARGE_PAGE_SIZE;
+  if ((fp = fopen(path, "r")) == NULL)
+    return -1;
 
-  shmid = shmget(IPC_PRIVATE, size, SHM_HUGETLB | SHM_R | SHM_W);
-  if (shmid < 0)
+  while (fgets(line, sizeof(line), fp) != NULL)
   {
-      log_errno(LOG_FATAL,
-                "Failed to allocate %zd bytes from HugeTLB memory.", size);
-
-      return NULL;
+    if (!strncmp(line, field, len) && line[len] == ':')
+    {
+      val = strtol(line + len + 1, NULL, 10);
+      break;
+    }
   }
 
-  ptr = shmat(shmid, NULL, 0);
-  if (ptr == (void *)-1)
+  fclose(fp);
+
+  return val;
+}
+
+static void memory_vm_sample(memory_vm_sample_t *sample)
+{
+  sample->anon_huge_kb = memory_proc_field("/proc/self/smaps_rollup",
+                                           "AnonHugePages");
+  sample->hugetlb_kb = memory_proc_field("/proc/self/smaps_rollup",
+                                         "Private_Hugetlb");
+  sample->pte_kb = memory_proc_field("/proc/self/status", "VmPTE");
+}
+
+/*
+  Print the huge page and page table footprint around PTE metadata enable,
+  and how enable_pte_meta treated PMD-mapped buffers.
+*/
+static void memory_report_page_backend(void)
+{
+  const memory_vm_sample_t * const a = &memory_vm_populated;
+  const memory_vm_sample_t * const b = &memory_vm_enabled;
+  const char *verdict;
+
+  log_text(LOG_NOTICE, "Page backend %s, before/after PTE metadata enable:",
+           memory_page_backend_names[memory_page_backend]);
+  log_text(LOG_NOTICE, "    AnonHugePages:                   %ld/%ld kB",
+           a->anon_huge_kb, b->anon_huge_kb);
+  log_text(LOG_NOTICE, "    Private_Hugetlb:                 %ld/%ld kB",
+           a->hugetlb_kb, b->hugetlb_kb);
+  log_text(LOG_NOTICE, "    VmPTE:                           %ld/%ld kB",
+           a->pte_kb, b->pte_kb);
+
+  if (!pte_meta_enabled)
+    verdict = "not enabled";
+  else if (pte_enable_failures > 0)
+    verdict = "enable failed";
+  else if (b->anon_huge_kb < a->anon_huge_kb)
+    verdict = "huge pages split";
+  else if (a->anon_huge_kb > 0 || a->hugetlb_kb > 0)
+    verdict = "huge pages kept";
+  else
+    verdict = "no huge pages mapped";
+
+  if (pte_enable_failures > 0)
+    log_text(LOG_NOTICE, "    PTE metadata:                    %s "
+             "(%u buffers, errno = %d)\n", verdict, pte_enable_failures,
+             pte_enable_errno);
+  else
+    log_text(LOG_NOTICE, "    PTE metadata:                    %s\n", verdict);
+}
+
+#ifdef HAVE_LARGE_PAGES
+
+/* Warn when the system THP mode keeps thp-madvise/thp-always from working */
+static void memory_check_thp(void)
+{
+  FILE *fp;
+  char mode[128];
+
+  if ((fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r")) == NULL)
   {
-    log_errno(LOG_FATAL, "Failed to attach shared memory segment,");
-    shmctl(shmid, IPC_RMID, &buf);
+    log_text(LOG_WARNING, "Transparent huge pages are not supported");
+    return;
+  }
+
+  if (fgets(mode, sizeof(mode), fp) == NULL)
+    mode[0] = '\0';
+  fclose(fp);
+
+  if (strstr(mode, "[never]") != NULL ||
+      (memory_page_backend == SB_MEM_PAGE_THP_ALWAYS &&
+       strstr(mode, "[always]") == NULL))
+    log_text(LOG_WARNING, "Transparent huge pages are set to '%s', buffers "
+             "may be backed by 4k pages", strtok(mode, "\n"));
+}
+
+/* Map size bytes aligned to a PMD so that they can be backed by THPs */
+static void *memory_alloc_thp(size_t size)
+{
+  const size_t align = PTE_META_PMD_SIZE;
+  const size_t len = (size + align - 1) & ~(align - 1);
+  char *ptr, *start;
 
+  ptr = mmap(NULL, len + align, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED)
+  {
+    log_errno(LOG_FATAL, "Failed to map %zu bytes", len + align);
     return NULL;
   }
 
-  /*
-        Remove the shared memory segment so that it will be automatically freed
-            after memory is detached or process exits
-  */
-  shmctl(shmid, IPC_RMID, &buf);
+  /* Trim the unaligned head and tail */
+  start = (char *) (((uintptr_t) ptr + align - 1) & ~(uintptr_t) (align - 1));
+  if (start > ptr)
+    munmap(ptr, start - ptr);
+  if (ptr + align > start)
+    munmap(start + len, ptr + align - start);
+
+#ifdef MADV_HUGEPAGE
+  if (memory_page_backend == SB_MEM_PAGE_THP_MADVISE &&
+      madvise(start, len, MADV_HUGEPAGE) != 0)
+    log_errno(LOG_WARNING, "madvise(MADV_HUGEPAGE) failed");
+#endif
+
+  return start;
+}
+
+/* Map size bytes from the HugeTLB pool of the given page size */
+static void *memory_alloc_hugetlb(size_t size, unsigned int page_shift)
+{
+  const size_t page = 1UL << page_shift;
+  const size_t len = (size + page - 1) & ~(page - 1);
+  void *ptr;
+
+  ptr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+             (page_shift << MAP_HUGE_SHIFT), -1, 0);
+  if (ptr == MAP_FAILED)
+  {
+    log_errno(LOG_FATAL, "Failed to allocate %zu bytes from the %zu KiB "
+              "HugeTLB pool (see /sys/kernel/mm/hugepages/hugepages-%zukB/"
+              "nr_hugepages)", len, page / 1024, page / 1024);
+    return NULL;
+  }
 
   return ptr;
 }
 
-#endif
\ No newline at end of file
+#endif /* HAVE_LARGE_PAGES */
+
+/* Allocate a buffer backed by the pages selected with --memory-page-backend */
+static void *memory_alloc(size_t size)
+{
+  size_t align = sb_getpagesize();
+
+  switch (memory_page_backend) {
+#ifdef HAVE_LARGE_PAGES
+  case SB_MEM_PAGE_THP_MADVISE:
+  case SB_MEM_PAGE_THP_ALWAYS:
+    return memory_alloc_thp(size);
+
+  case SB_MEM_PAGE_HUGETLB_2M:
+    return memory_alloc_hugetlb(size, 21);
+
+  case SB_MEM_PAGE_HUGETLB_1G:
+    return memory_alloc_hugetlb(size, 30);
+#endif
+
+  default:
+    /*
+      Align to the largest power of 2 dividing size, up to a PMD, so that
+      small buffers never straddle a PMD boundary.
+    */
+    while (align < PTE_META_PMD_SIZE && size % (align * 2) == 0)
+      align *= 2;
+
+    return sb_memalign(size, align);
+  }
+}
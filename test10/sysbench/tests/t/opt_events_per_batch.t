@@ -0,0 +1,35 @@
+########################################################################
+--events-per-batch tests
+########################################################################
+
+  $ sysbench --events-per-batch=0 cpu run
+  FATAL: Invalid value for --events-per-batch: 0.
+  
+  [1]
+
+  $ sysbench --events-per-batch=4 --rate=10 cpu run
+  FATAL: --events-per-batch cannot be used with --rate, events are queued and timed one by one.
+  
+  [1]
+
+The event limit is honored exactly when it is not a multiple of the batch
+size, across threads
+
+  $ sysbench --events-per-batch=7 --events=100 --time=0 --threads=3 cpu run | grep -E 'Events per batch|total number of events'
+  Events per batch: 7 (amortized latency)
+      total number of events:              100
+
+  $ sysbench --events-per-batch=64 --memory-total-size=1M --memory-block-size=1K --time=0 memory run | grep -E 'Total operations|total number of events'
+  Total operations: 1024 \( *[0-9.]+ per second\) (re)
+      total number of events:              1024
+
+Tests with their own event loop ignore it
+
+  $ cat >$CRAMTMP/events_per_batch.lua <<EOF
+  > function event()
+  > end
+  > EOF
+
+  $ sysbench --events-per-batch=8 --events=10 --time=0 $CRAMTMP/events_per_batch.lua run 2>&1 | grep -E 'events-per-batch|total number of events'
+  WARNING: --events-per-batch is ignored, this test runs its own event loop
+      total number of events:              10
@@ -20,8 +20,11 @@ separately.
     --thread-stack-size=SIZE        size of stack per thread [64K]
     --thread-init-timeout=N         wait time in seconds for worker threads to initialize [30]
     --rate=N                        average transactions rate. 0 for unlimited rate [0]
+    --rate-response-time[=on|off]   with --rate, report response times measured from the scheduled start of each event, including the time it waited for a free thread, separately from service times [off]
+    --events-per-batch=N            number of events the default event loop executes back to back and times as one unit. Each event is accounted with the amortized latency [1]
     --report-interval=N             periodically report intermediate statistics with a specified interval in seconds. 0 disables intermediate reports [0]
     --report-checkpoints=[LIST,...] dump full statistics and reset all counters at specified points in time. The argument is a list of comma-separated values representing the amount of time in seconds elapsed from start of test when report checkpoint(s) must be performed. Report checkpoints are off by default. []
+    --timer=STRING                  clock source for event timing and reports {monotonic,tsc}. tsc reads the CPU cycle counter calibrated against CLOCK_MONOTONIC, falling back to monotonic when it is not invariant [monotonic]
     --debug[=on|off]                print more debugging info [off]
     --validate[=on|off]             perform validation checks where possible [off]
     --help[=on|off]                 print help and exit [off]
@@ -40,6 +43,7 @@ separately.
   
     --percentile=N       percentile to calculate in latency statistics (1-100). Use the special value of 0 to disable percentile calculations [95]
     --histogram[=on|off] print latency histogram in report [off]
+    --histogram-digits=N number of significant decimal digits kept by latency histograms (1-3) [2]
   
   General database options:
   
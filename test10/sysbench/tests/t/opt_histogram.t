@@ -49,3 +49,11 @@
       events (avg/stddev):           1.0000/0.00
       execution time (avg/stddev):   */* (glob)
   
+
+  $ sysbench --histogram-digits=0 cpu run
+  FATAL: Invalid value for --histogram-digits: 0
+  [1]
+
+  $ sysbench --histogram --histogram-digits=1 --events=1 --time=0 cpu run | sed -n '/Latency histogram/,/^ *$/p' | head -2
+  Latency histogram (values are in milliseconds)
+         value  ------------- distribution ------------- count
@@ -0,0 +1,56 @@
+########################################################################
+--rate-response-time tests
+########################################################################
+
+  $ sysbench --rate-response-time cpu run
+  FATAL: --rate-response-time requires --rate
+  [1]
+
+  $ sysbench --rate=10 --rate-response-time --percentile=0 cpu run
+  FATAL: --rate-response-time cannot be used with --percentile=0
+  [1]
+
+Events take longer than the interval between them, so response times
+measured from the schedule grow past service times
+
+  $ cat >$CRAMTMP/response_time.lua <<EOF
+  > ffi.cdef[[int usleep(unsigned int);]]
+  > function event()
+  >   ffi.C.usleep(100000)
+  > end
+  > EOF
+
+  $ sysbench --rate=20 --rate-response-time --time=2 $CRAMTMP/response_time.lua run | sed -n -e '/^Response times/p' -e '/^Service time/,/^$/p' -e '/^Response time percentiles/,/^$/p'
+  Response times are measured from scheduled event start times
+  Service time percentiles (ms):
+           p50:    *.* (glob)
+           p90:    *.* (glob)
+           p99:    *.* (glob)
+           p99.9:    *.* (glob)
+           p99.99:    *.* (glob)
+           max:    *.* (glob)
+  
+  Response time percentiles (ms, from scheduled start):
+           95th percentile:    *.* (glob)
+           p50:    *.* (glob)
+           p90:    *.* (glob)
+           p99:    *.* (glob)
+           p99.9:    *.* (glob)
+           p99.99:    *.* (glob)
+           max:    *.* (glob)
+  
+
+  $ sysbench --rate=20 --rate-response-time --time=2 $CRAMTMP/response_time.lua run | awk '/^Service time/ { s = 1 } /^Response time/ { s = 2 } /max:/ { m[s] = $2 } END { print (m[2] > m[1] + 100) ? "response > service" : "response <= service" }'
+  response > service
+
+sysbench.report_json exposes both
+
+  $ cat >>$CRAMTMP/response_time.lua <<EOF
+  > sysbench.hooks.report_cumulative = sysbench.report_json
+  > EOF
+
+  $ sysbench --rate=20 --rate-response-time --time=1 $CRAMTMP/response_time.lua run | grep -E '"(latency|response_time|service_time_pcts|response_time_pcts)"'
+      "latency": *.*, (glob)
+      "response_time": *.*, (glob)
+      "service_time_pcts": { "p50": *.*, "p90": *.*, "p99": *.*, "p99.9": *.*, "p99.99": *.*, "max": *.* }, (glob)
+      "response_time_pcts": { "p50": *.*, "p90": *.*, "p99": *.*, "p99.9": *.*, "p99.99": *.*, "max": *.* }, (glob)
@@ -0,0 +1,20 @@
+########################################################################
+--timer tests
+########################################################################
+
+  $ sysbench --timer=hpet cpu run
+  FATAL: Invalid value for --timer: 'hpet'
+  [1]
+
+  $ sysbench --timer=monotonic --events=100 --time=0 cpu run | grep -E '^Timer|total number of events'
+      total number of events:              100
+
+Without an invariant cycle counter, --timer=tsc falls back to
+CLOCK_MONOTONIC with a warning, so either line is accepted.
+
+  $ sysbench --timer=tsc --events=100 --time=0 cpu run 2>&1 | grep -E 'Timer|TSC|cycle counter|total number of events'
+  (Timer: tsc \([0-9.]+ MHz, calibrated against CLOCK_MONOTONIC\)|WARNING: .*using CLOCK_MONOTONIC for timers) (re)
+      total number of events:              100
+
+  $ sysbench --timer=tsc --time=2 --report-interval=1 cpu run 2>&1 | grep -c '^\[ 1s \]'
+  1
@@ -4,26 +4,43 @@ memory benchmark tests
 
   $ args="memory --memory-block-size=4K --memory-total-size=1G --events=1 --time=0 --threads=2"
 
-The --memory-hugetlb option is supported and printed by 'sysbench
-help' only on Linux.
+The --memory-hugetlb and --memory-page-backend options are supported and
+printed by 'sysbench help' only on Linux.
 
   $ if [ "$(uname -s)" = "Linux" ]
   > then
   >   sysbench $args help | grep hugetlb
   > else
-  >   echo "  --memory-hugetlb[=on|off]   allocate memory from HugeTLB pool [off]"
+  >   echo "  --memory-hugetlb[=on|off]             allocate memory from HugeTLB pool [off]"
+  >   echo "  --memory-page-backend=STRING          pages backing the memory buffers {4k,thp-madvise,thp-always,hugetlb-2m,hugetlb-1g} [4k]"
   > fi
-    --memory-hugetlb[=on|off]   allocate memory from HugeTLB pool [off]
+    --memory-hugetlb[=on|off]             allocate memory from HugeTLB pool [off]
+    --memory-page-backend=STRING          pages backing the memory buffers {4k,thp-madvise,thp-always,hugetlb-2m,hugetlb-1g} [4k]
 
   $ sysbench $args help | grep -v hugetlb
   sysbench * (glob)
   
   memory options:
-    --memory-block-size=SIZE    size of memory block for test [1K]
-    --memory-total-size=SIZE    total size of data to transfer [100G]
-    --memory-scope=STRING       memory access scope {global,local} [global]
-    --memory-oper=STRING        type of memory operations {read, write, none} [write]
-    --memory-access-mode=STRING memory access mode {seq,rnd} [seq]
+    --memory-block-size=SIZE              size of memory block for test [1K]
+    --memory-total-size=SIZE              total size of data to transfer [100G]
+    --memory-working-set=SIZE             size of the memory region each event selects its block from, 0 to use a single block [0]
+    --memory-scope=STRING                 memory access scope {global,local} [global]
+    --memory-oper=STRING                  type of memory operations {read, write, none} [write]
+    --memory-access-mode=STRING           memory access mode {seq,rnd} [seq]
+    --memory-pte-meta[=on|off]            enable PTE metadata syscalls [off]
+    --memory-pte-meta-type=N              PTE metadata type (0 or 1) [0]
+    --memory-pte-meta-backend=STRING      PTE metadata backend {kernel,emul} [kernel]
+    --memory-pte-meta-granularity=STRING  PTE metadata update granularity: every written word, or the final value per page {word,page,event} [word]
+    --memory-pte-meta-batch=N             number of PTE metadata operations submitted at once through the vectored API, 1 to disable batching [1]
+    --memory-pte-meta-read-cache[=on|off] cache get_pte_meta results per thread, invalidated by metadata writes [off]
+    --memory-pte-meta-read-cache-sets=N   with --memory-pte-meta-read-cache and --memory-oper=read, update the metadata of every Nth looked-up page before the lookup, invalidating cached reads of its region, 0 to disable [0]
+    --memory-pte-meta-async[=on|off]      queue metadata updates to dedicated drainer threads instead of issuing them inline [off]
+    --memory-pte-meta-async-drainers=N    number of drainer threads for --memory-pte-meta-async [1]
+    --memory-pte-meta-sharing=STRING      PTEs targeted by the metadata operations of different threads, and per-thread latency reporting {scope,private,shared-page,shared-pmd,shared-region} [scope]
+    --memory-pte-meta-evict=STRING        evict the target page from the caches and the TLB before every other direct metadata operation and report cold and warm latency separately {none,clflush,tlb,mprotect} [none]
+    --memory-pte-meta-validate[=on|off]   write deterministic metadata values and verify the metadata of every page at the end of the run [off]
+    --memory-pte-meta-validate-threads=N  number of verifier threads for --memory-pte-meta-validate, 0 to use one per worker thread [0]
+    --memory-perf-events=[LIST,...]       comma-separated list of performance counters to collect per worker thread, e.g. cycles,instructions,dTLB-load-misses,page-faults or rNNNN for raw events []
   
   $ sysbench $args prepare
   sysbench *.* * (glob)
@@ -72,6 +89,7 @@ help' only on Linux.
     total size: 1024MiB
     operation: read
     scope: global
+    PTE metadata: disabled
   
   Initializing worker threads...
   
@@ -115,6 +133,7 @@ help' only on Linux.
     total size: 1024MiB
     operation: write
     scope: global
+    PTE metadata: disabled
   
   Initializing worker threads...
   
@@ -158,6 +177,7 @@ help' only on Linux.
     total size: 1024MiB
     operation: read
     scope: local
+    PTE metadata: disabled
   
   Initializing worker threads...
   
@@ -201,6 +221,7 @@ help' only on Linux.
     total size: 1024MiB
     operation: write
     scope: local
+    PTE metadata: disabled
   
   Initializing worker threads...
   
@@ -227,6 +248,263 @@ help' only on Linux.
       events (avg/stddev):           */* (glob)
       execution time (avg/stddev):   */* (glob)
   
+########################################################################
+# PTE metadata, userspace emulation backend
+########################################################################
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=foo run
+  sysbench * (glob)
+  
+  FATAL: Invalid value for memory-pte-meta-backend: foo
+  [1]
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-total-size=4M run | grep -E 'PTE|Total operations'
+    PTE metadata: enabled (type=0, backend=emul, granularity=word, batch=1, read cache=off, async=off)
+  Total operations: 1024 (* per second) (glob)
+  PTE metadata enable: 1 PMDs expanded in * ms (* us per PMD) (glob)
+  PTE metadata updates: 523264 (511.00 per event, * per second) (glob)
+  PTE metadata emulation: 1 PTE pages expanded (4 KiB of metadata)
+  PTE metadata disable: 1 PMDs collapsed in * ms (* us per PMD) (glob)
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-type=1 --memory-pte-meta-backend=emul --memory-oper=read --memory-total-size=4M run | grep -E 'PTE|Total operations'
+    PTE metadata: enabled (type=1, backend=emul, granularity=word, batch=1, read cache=off, async=off)
+  Total operations: 1024 (* per second) (glob)
+  PTE metadata enable: 1 PMDs expanded in * ms (* us per PMD) (glob)
+  PTE metadata lookups: 523264 (511.00 per event, * per second) (glob)
+  PTE metadata emulation: 1 PTE pages expanded (4 KiB of metadata)
+  PTE metadata disable: 1 PMDs collapsed in * ms (* us per PMD) (glob)
+
+########################################################################
+# PTE metadata update granularity
+########################################################################
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-granularity=foo run
+  sysbench * (glob)
+  
+  FATAL: Invalid value for memory-pte-meta-granularity: foo
+  [1]
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-granularity=page --memory-block-size=16K --memory-total-size=16M run | grep -E 'PTE|Total operations'
+    PTE metadata: enabled (type=0, backend=emul, granularity=page, batch=1, read cache=off, async=off)
+  Total operations: 1024 (* per second) (glob)
+  PTE metadata enable: 1 PMDs expanded in * ms (* us per PMD) (glob)
+  PTE metadata updates: 4096 (4.00 per event, * per second) (glob)
+  PTE metadata emulation: 1 PTE pages expanded (4 KiB of metadata)
+  PTE metadata disable: 1 PMDs collapsed in * ms (* us per PMD) (glob)
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-type=1 --memory-pte-meta-backend=emul --memory-pte-meta-granularity=event --memory-access-mode=rnd --memory-block-size=16K --memory-total-size=16M run | grep -E 'PTE|Total operations'
+    PTE metadata: enabled (type=1, backend=emul, granularity=event, batch=1, read cache=off, async=off)
+  Total operations: 1024 (* per second) (glob)
+  PTE metadata enable: 1 PMDs expanded in * ms (* us per PMD) (glob)
+  PTE metadata updates: 4096 (4.00 per event, * per second) (glob)
+  PTE metadata emulation: 1 PTE pages expanded (4 KiB of metadata)
+  PTE metadata disable: 1 PMDs collapsed in * ms (* us per PMD) (glob)
+
+########################################################################
+# Vectored PTE metadata operations
+########################################################################
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-batch=0 run
+  sysbench * (glob)
+  
+  FATAL: Invalid value for memory-pte-meta-batch: 0
+  [1]
+
+Redundant updates to the same page within a batch are folded
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-type=1 --memory-pte-meta-backend=emul --memory-pte-meta-batch=256 --memory-block-size=16K --memory-total-size=16M run | grep -E 'PTE metadata(: enabled| updates| batches)|Total operations'
+    PTE metadata: enabled (type=1, backend=emul, granularity=word, batch=256, read cache=off, async=off)
+  Total operations: 1024 (* per second) (glob)
+  PTE metadata updates: 2096128 (2047.00 per event, * per second) (glob)
+  PTE metadata batches: 8192 of up to 256 operations, 8192 calls (1.00 per batch)
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-batch=256 --memory-oper=read --memory-access-mode=rnd --memory-block-size=16K --memory-total-size=16M run | grep -E 'PTE metadata (lookups|batches)'
+  PTE metadata lookups: 2097152 (2048.00 per event, * per second) (glob)
+  PTE metadata batches: 8192 of up to 256 operations, 32768 calls (4.00 per batch)
+
+########################################################################
+# PTE metadata read cache
+########################################################################
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-read-cache=on --memory-oper=read --memory-block-size=16K --memory-total-size=16M run | grep -E 'PTE metadata(: enabled| lookups| read cache)'
+    PTE metadata: enabled (type=0, backend=emul, granularity=word, batch=1, read cache=on, async=off)
+  PTE metadata lookups: 2096128 (2047.00 per event, * per second) (glob)
+  PTE metadata read cache: 2096120 hits, 8 misses (100.00% hit ratio)
+
+Sets issued while lookups run bump the region generation: every set is
+followed by a miss and a refill, and no cached entry is served after a set
+
+  $ sysbench $args --threads=1 --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-read-cache=on --memory-pte-meta-read-cache-sets=16 --memory-oper=read --memory-block-size=16K --memory-total-size=16M run | grep -A1 -E 'PTE metadata read cache'
+  PTE metadata read cache: 1961280 hits, 134848 misses (93.57% hit ratio)
+      131008 sets from the lookup path, 0 stale hits after a set
+
+Sets from other threads invalidate entries as well
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-read-cache=on --memory-pte-meta-read-cache-sets=64 --memory-pte-meta-sharing=shared-page --memory-oper=read --memory-block-size=16K --memory-total-size=16M run | grep -A1 -E 'PTE metadata read cache'
+  PTE metadata read cache: * hits, * misses (*% hit ratio) (glob)
+      * sets from the lookup path, 0 stale hits after a set (glob)
+
+  $ sysbench $args --memory-pte-meta-read-cache-sets=-1 run
+  sysbench * (glob)
+  
+  FATAL: Invalid value for memory-pte-meta-read-cache-sets: -1
+  [1]
+
+########################################################################
+# Asynchronous PTE metadata updates
+########################################################################
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-async=on --memory-pte-meta-async-drainers=0 run
+  sysbench * (glob)
+  
+  FATAL: Invalid value for memory-pte-meta-async-drainers: 0
+  [1]
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-async=on --memory-block-size=16K --memory-total-size=16M run | grep -E 'PTE metadata(: enabled| updates| async)|queue depth|drain lag|visibility'
+    PTE metadata: enabled (type=0, backend=emul, granularity=word, batch=1, read cache=off, async=on)
+  PTE metadata updates: 2096128 (2047.00 per event, * per second) (glob)
+  PTE metadata async: 1 drainer threads, 2096128 updates queued, 2096128 drained in 2096128 calls
+      queue depth (avg/max):           */* (* enqueue retries on a full ring) (glob)
+      drain lag (avg/95th/max, us):    */*/* (glob)
+      visibility (avg/95th/max, us):   */*/* (glob)
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-type=1 --memory-pte-meta-backend=emul --memory-pte-meta-async=on --memory-pte-meta-async-drainers=2 --memory-pte-meta-granularity=page --memory-pte-meta-batch=16 --memory-block-size=16K --memory-total-size=16M run | grep -E 'PTE metadata (updates|async)'
+  PTE metadata updates: 4096 (4.00 per event, * per second) (glob)
+  PTE metadata async: 2 drainer threads, 4096 updates queued, 4096 drained in * calls (glob)
+
+A block larger than a PMD is expanded and collapsed as a whole
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-granularity=event --memory-block-size=4M --memory-total-size=16M run | grep -E 'PMD|emulation'
+  PTE metadata enable: [23] PMDs expanded in .* ms \(.* us per PMD\) (re)
+  PTE metadata emulation: [23] PTE pages expanded \([0-9]+ KiB of metadata\) (re)
+  PTE metadata disable: [23] PMDs collapsed in .* ms \(.* us per PMD\) (re)
+
+########################################################################
+# Sharing of metadata PTEs between threads
+########################################################################
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-sharing=shared-pte run
+  sysbench * (glob)
+  
+  FATAL: Invalid value for memory-pte-meta-sharing: shared-pte
+  [1]
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-sharing=shared-page --memory-block-size=16K --memory-total-size=16M run | grep -E 'scope|sharing|PMDs|latency|thread   '
+    scope: global
+    PTE metadata sharing: shared-page
+  PTE metadata enable: 2 PMDs expanded in * ms (* us per PMD) (glob)
+  PTE metadata shared-page latency per thread (50th/95th/99th/max, us):
+      thread   0: * (1048064 operations) (glob)
+      thread   1: * (1048064 operations) (glob)
+  PTE metadata disable: 2 PMDs collapsed in * ms (* us per PMD) (glob)
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-sharing=private --memory-block-size=16K --memory-total-size=16M run | grep -E 'scope|sharing'
+    scope: local
+    PTE metadata sharing: private
+
+########################################################################
+# Working set larger than a block
+########################################################################
+
+  $ sysbench $args --memory-working-set=6K run
+  sysbench * (glob)
+  
+  FATAL: Invalid value for memory-working-set: 6K (must be a multiple of memory-block-size)
+  [1]
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-working-set=64M --memory-total-size=16M run | grep -E 'working set|Total operations|PMD|emulation'
+    working set: 64MiB (16384 blocks)
+  Total operations: 4096 (* per second) (glob)
+  PTE metadata enable: 3[23] PMDs expanded in .* ms \(.* us per PMD\) (re)
+  PTE metadata emulation: 3[23] PTE pages expanded \([0-9]+ KiB of metadata\) (re)
+  PTE metadata disable: 3[23] PMDs collapsed in .* ms \(.* us per PMD\) (re)
+
+  $ sysbench $args --memory-scope=local --memory-access-mode=rnd --memory-working-set=1M --memory-total-size=16M run | grep -E 'working set|Total operations'
+    working set: 1MiB (256 blocks)
+  Total operations: 4096 (* per second) (glob)
+
+########################################################################
+# Page backends
+########################################################################
+
+  $ sysbench $args --memory-page-backend=64k run
+  sysbench * (glob)
+  
+  FATAL: Invalid value for memory-page-backend: 64k
+  [1]
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-page-backend=thp-madvise --memory-working-set=8M --memory-total-size=16M run 2>&1 | grep -E 'page backend|Page backend|^    [A-Z][A-Za-z_ ]+:  |After PTE'
+    page backend: thp-madvise
+  Page backend thp-madvise, before/after PTE metadata enable:
+      AnonHugePages:                   */* kB (glob)
+      Private_Hugetlb:                 */* kB (glob)
+      VmPTE:                           */* kB (glob)
+      PTE metadata:                    (huge pages kept|no huge pages mapped) (re)
+  After PTE metadata disable: AnonHugePages * kB, Private_Hugetlb * kB, VmPTE * kB (glob)
+
+########################################################################
+# Cold vs warm metadata latency
+########################################################################
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-evict=wbinvd run
+  sysbench * (glob)
+  
+  FATAL: Invalid value for memory-pte-meta-evict: wbinvd
+  [1]
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-evict=tlb --memory-pte-meta-batch=16 --memory-block-size=16K --memory-total-size=16M run 2>&1 | grep -E 'Cold|evict'
+  WARNING: Cold/warm PTE metadata latency is only collected for direct operations, not with batching or async updates
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-evict=mprotect --memory-oper=read --memory-block-size=16K --memory-total-size=16M run | grep -E 'evict|warm:|cold:'
+    PTE metadata eviction: mprotect (every other operation)
+  PTE metadata warm/cold latency, mprotect eviction (50th/95th/99th/max, us):
+      warm: * (1048064 operations) (glob)
+      cold: * (1048064 operations) (glob)
+
+########################################################################
+# End-of-run metadata validation
+########################################################################
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-validate=on --memory-block-size=1K run
+  sysbench * (glob)
+  
+  FATAL: --memory-pte-meta-validate requires memory-working-set to be a multiple of the page size (*) (glob)
+  [1]
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-validate=on --memory-oper=read --memory-block-size=16K --memory-total-size=16M run 2>&1 | grep -E 'validat'
+  WARNING: --memory-pte-meta-validate requires --memory-pte-meta=on and --memory-oper=write with metadata on the buffers, validation disabled
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-type=1 --memory-pte-meta-backend=emul --memory-pte-meta-validate=on --memory-scope=local --memory-access-mode=rnd --memory-working-set=4M --memory-total-size=16M run | grep -E 'validation|mismatches'
+    PTE metadata validation: on (2 verifier threads)
+  PTE metadata validation: 2048 pages checked by 2 threads in * ms (* pages/sec) (glob)
+      mismatches: 0 (0 missing, 0 stale, 0 corrupt)
+
+  $ sysbench $args --memory-pte-meta=on --memory-pte-meta-backend=emul --memory-pte-meta-validate=on --memory-pte-meta-validate-threads=3 --memory-pte-meta-batch=16 --memory-pte-meta-granularity=page --memory-access-mode=rnd --memory-working-set=4M --memory-total-size=16M run | grep -E 'validation|mismatches'
+    PTE metadata validation: on (3 verifier threads)
+  PTE metadata validation: 1024 pages checked by 3 threads in * ms (* pages/sec) (glob)
+      mismatches: 0 (0 missing, 0 stale, 0 corrupt)
+
+########################################################################
+# Performance counters
+########################################################################
+
+  $ sysbench $args --memory-perf-events=cycles,bogus run
+  sysbench * (glob)
+  
+  FATAL: Invalid value for memory-perf-events: bogus
+  [1]
+
+  $ sysbench $args --memory-perf-events=page-faults,context-switches --memory-total-size=16M run | grep -E 'perf events|Performance counters|page-faults  |context-switches  '
+    perf events: page-faults,context-switches* (glob)
+  Performance counters (summed over 2 threads*): (glob)
+      page-faults * per second, * per event) (glob)
+      context-switches * per second, * per event) (glob)
+
+Intermediate reports show each counter per second and per event
+
+  $ sysbench memory --memory-perf-events=task-clock --memory-block-size=4K --memory-total-size=100T --time=2 --report-interval=1 run | grep -E '^\[ 1s \]'
+  [ 1s ] * MiB/sec, task-clock/s: *, task-clock/event: *.* (glob)
+
   $ sysbench $args cleanup
   sysbench *.* * (glob)
   
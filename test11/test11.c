@@ -0,0 +1,240 @@
+/*
+ * test11.c - Page table memory overhead and set/get latency vs. region size
+ *
+ * Maps regions from 2MiB up to MAX_SIZE (doubling each step), faults in one
+ * page per PMD so that every PMD has a PTE page, and enables metadata on all
+ * of them. VmPTE (/proc/self/status) and PageTables (/proc/meminfo) are
+ * sampled before and after, and set/get latency is measured on random pages
+ * of the enabled region.
+ *
+ * Usage: ./test11 [MAX_SIZE [SAMPLES]]   e.g. ./test11 64G 20000
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "pte_meta_syscalls.h"
+
+#define MIN_SIZE        PTE_META_PMD_SIZE
+#define DEFAULT_MAX     (16ULL << 30)   // 16GiB, 8192 PTE pages
+#define DEFAULT_SAMPLES 10000
+#define META_VALUE_BASE 0xFEEDFACE00000000ULL
+
+/* One row of the scaling curve */
+struct step {
+    size_t size;
+    unsigned long pmds;
+    long pte_kb_before, pte_kb_after;       // VmPTE
+    long pt_kb_before, pt_kb_after;         // PageTables, system-wide
+    double enable_us_per_pmd;
+    double set_avg, set_p99;                // ns
+    double get_avg, get_p99;                // ns
+};
+
+static size_t parse_size(const char *s)
+{
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+
+    switch (*end) {
+    case 'k': case 'K': v <<= 10; break;
+    case 'm': case 'M': v <<= 20; break;
+    case 'g': case 'G': v <<= 30; break;
+    case 't': case 'T': v <<= 40; break;
+    case '\0': break;
+    default:
+        fprintf(stderr, "Invalid size: %s\n", s);
+        exit(EXIT_FAILURE);
+    }
+    return (size_t)v;
+}
+
+/* Value in kB of a "Field:   N kB" line of a /proc file, -1 if missing */
+static long proc_field_kb(const char *path, const char *field)
+{
+    char line[256];
+    size_t len = strlen(field);
+    long val = -1;
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            val = strtol(line + len + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(fp);
+    return val;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Mean and 99th percentile of n samples, sorts the array */
+static void summarize(double *ns, int n, double *avg, double *p99)
+{
+    double sum = 0;
+
+    for (int i = 0; i < n; i++)
+        sum += ns[i];
+    qsort(ns, n, sizeof(double), cmp_double);
+    *avg = sum / n;
+    *p99 = ns[(int)((n - 1) * 0.99)];
+}
+
+/* First page of PMD 'pmd', the only page of each PMD that is populated */
+static unsigned long page_addr(uint8_t *base, unsigned long pmd)
+{
+    return (unsigned long)(base + pmd * PTE_META_PMD_SIZE);
+}
+
+static int run_step(size_t size, int samples, double *set_ns, double *get_ns,
+                    struct step *st)
+{
+    struct pte_meta_range_stats stats = { 0 };
+    unsigned long pmds = size / PTE_META_PMD_SIZE;
+    uint8_t *map, *base;
+
+    // Over-map by one PMD so the region can start on a PMD boundary
+    map = mmap(NULL, size + PTE_META_PMD_SIZE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    base = (uint8_t *)(((unsigned long)map + PTE_META_PMD_SIZE - 1) &
+                       ~(PTE_META_PMD_SIZE - 1));
+#ifdef MADV_NOHUGEPAGE
+    // A THP-mapped PMD has no PTE page to expand
+    madvise(base, size, MADV_NOHUGEPAGE);
+#endif
+
+    // Fault in one page per PMD, this allocates its PTE page
+    for (unsigned long i = 0; i < pmds; i++)
+        base[i * PTE_META_PMD_SIZE] = (uint8_t)i;
+
+    st->size = size;
+    st->pmds = pmds;
+    st->pte_kb_before = proc_field_kb("/proc/self/status", "VmPTE");
+    st->pt_kb_before = proc_field_kb("/proc/meminfo", "PageTables");
+
+    if (enable_pte_meta_range((unsigned long)base, size, &stats) != 0) {
+        perror("enable_pte_meta");
+        munmap(map, size + PTE_META_PMD_SIZE);
+        return -1;
+    }
+
+    st->pte_kb_after = proc_field_kb("/proc/self/status", "VmPTE");
+    st->pt_kb_after = proc_field_kb("/proc/meminfo", "PageTables");
+    st->enable_us_per_pmd = stats.pmds ? stats.ns / 1e3 / stats.pmds : 0;
+
+    // Set then get metadata on random populated pages of the region
+    for (int i = 0; i < samples; i++) {
+        unsigned long addr = page_addr(base, (unsigned long)random() % pmds);
+        uint64_t value = META_VALUE_BASE | (uint64_t)i;
+        struct timespec t0, t1;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (set_pte_meta(addr, 0, (unsigned long)&value) != 0) {
+            perror("set_pte_meta");
+            exit(EXIT_FAILURE);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        set_ns[i] = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    }
+    for (int i = 0; i < samples; i++) {
+        unsigned long addr = page_addr(base, (unsigned long)random() % pmds);
+        uint64_t value;
+        struct timespec t0, t1;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (get_pte_meta(addr, &value) != 0 && errno != ENODATA) {
+            perror("get_pte_meta");
+            exit(EXIT_FAILURE);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        get_ns[i] = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    }
+    summarize(set_ns, samples, &st->set_avg, &st->set_p99);
+    summarize(get_ns, samples, &st->get_avg, &st->get_p99);
+
+    if (disable_pte_meta_range((unsigned long)base, size, NULL) != 0)
+        perror("disable_pte_meta");
+    munmap(map, size + PTE_META_PMD_SIZE);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t max_size = argc > 1 ? parse_size(argv[1]) : DEFAULT_MAX;
+    int samples = argc > 2 ? atoi(argv[2]) : DEFAULT_SAMPLES;
+    double *set_ns, *get_ns;
+
+    if (max_size < MIN_SIZE || samples < 1) {
+        fprintf(stderr, "Usage: %s [MAX_SIZE >= 2M [SAMPLES >= 1]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    set_ns = malloc(samples * sizeof(double));
+    get_ns = malloc(samples * sizeof(double));
+    if (set_ns == NULL || get_ns == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    printf("\n=== Test11: Page Table Overhead Scaling ===\n\n");
+    printf("    backend: %s, %d set/get samples per step\n",
+           pte_meta_backend_name(pte_meta_get_backend()), samples);
+    printf("    VmPTE is per process, PageTables is system-wide\n");
+    if (pte_meta_get_backend() == PTE_META_BACKEND_EMUL)
+        printf("    emul keeps metadata in a heap shadow table, VmPTE does not grow\n");
+    printf("\n");
+
+    printf("    %10s %8s %19s %19s %14s %10s %21s %21s\n",
+           "region", "PTE pgs", "VmPTE KiB", "PageTables KiB", "KiB per GiB",
+           "enable us", "set avg/p99 ns", "get avg/p99 ns");
+    printf("    %10s %8s %19s %19s %14s %10s %21s %21s\n",
+           "", "", "(before->after)", "(before->after)", "(VmPTE delta)",
+           "per PMD", "", "");
+
+    for (size_t size = MIN_SIZE; size <= max_size; size *= 2) {
+        struct step st;
+        char region[32];
+
+        if (run_step(size, samples, set_ns, get_ns, &st) != 0)
+            return EXIT_FAILURE;
+
+        if (size >= (1UL << 30))
+            snprintf(region, sizeof(region), "%zuGiB", size >> 30);
+        else
+            snprintf(region, sizeof(region), "%zuMiB", size >> 20);
+
+        printf("    %10s %8lu %8ld->%-9ld %8ld->%-9ld %14.1f %10.2f %10.0f/%-10.0f %10.0f/%-10.0f\n",
+               region, st.pmds, st.pte_kb_before, st.pte_kb_after,
+               st.pt_kb_before, st.pt_kb_after,
+               (st.pte_kb_after - st.pte_kb_before) /
+               ((double)size / (1UL << 30)),
+               st.enable_us_per_pmd, st.set_avg, st.set_p99,
+               st.get_avg, st.get_p99);
+        fflush(stdout);
+    }
+
+    printf("\n    ✓ Test completed successfully\n");
+
+    free(set_ns);
+    free(get_ns);
+    return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * test12.c - Multi-threaded enable/disable churn on private and shared PMDs
+ *
+ * N threads repeatedly enable and disable metadata on their own PMDs, which
+ * live either in a mapping private to each thread or in one mapping shared by
+ * all threads. Every enable and disable is timed. For each thread count the
+ * test reports throughput, scaling relative to one thread, and tail latency,
+ * so contention in the expansion path (mmap_lock, page table locks) shows up
+ * as flat scaling and growing tails.
+ *
+ * Usage: ./test12 [MAX_THREADS [CYCLES]]   e.g. ./test12 16 5000
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "pte_meta_syscalls.h"
+
+#define PMDS_PER_THREAD 4       // PMDs each thread cycles through
+#define DEFAULT_CYCLES  2000    // enable/disable cycles per thread and step
+
+enum { MODE_PRIVATE, MODE_SHARED };
+
+static const char *mode_names[] = {
+    "private PMDs (one mapping per thread)",
+    "shared mapping (disjoint PMDs of one mapping)",
+};
+
+struct worker {
+    pthread_t thread;
+    uint8_t *pmds;              // first of PMDS_PER_THREAD PMDs
+    int cycles;
+    double *ns;                 // 2 * cycles * PMDS_PER_THREAD latencies
+    double start, end;          // first and last timestamps of the run
+    unsigned long errors;
+};
+
+static pthread_barrier_t start_barrier;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double pct(const double *sorted, size_t n, double p)
+{
+    return sorted[(size_t)((n - 1) * p)];
+}
+
+/* Map npmds PMD-aligned PMDs and fault in one page of each */
+static uint8_t *map_pmds(size_t npmds, uint8_t **map)
+{
+    size_t len = (npmds + 1) * PTE_META_PMD_SIZE;
+    uint8_t *base;
+
+    *map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (*map == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    base = (uint8_t *)(((unsigned long)*map + PTE_META_PMD_SIZE - 1) &
+                       ~(PTE_META_PMD_SIZE - 1));
+#ifdef MADV_NOHUGEPAGE
+    madvise(base, npmds * PTE_META_PMD_SIZE, MADV_NOHUGEPAGE);
+#endif
+    for (size_t i = 0; i < npmds; i++)
+        base[i * PTE_META_PMD_SIZE] = 1;
+    return base;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    double *ns = w->ns;
+
+    pthread_barrier_wait(&start_barrier);
+
+    w->start = now_ns();
+    for (int c = 0; c < w->cycles; c++) {
+        for (int p = 0; p < PMDS_PER_THREAD; p++) {
+            unsigned long addr = (unsigned long)(w->pmds + p * PTE_META_PMD_SIZE);
+            double t0, t1, t2;
+
+            t0 = now_ns();
+            if (enable_pte_meta(addr) != 0)
+                w->errors++;
+            t1 = now_ns();
+            if (disable_pte_meta(addr) != 0)
+                w->errors++;
+            t2 = now_ns();
+
+            *ns++ = t1 - t0;
+            *ns++ = t2 - t1;
+        }
+    }
+    w->end = now_ns();
+    return NULL;
+}
+
+/* Run one step and print its row, returns ops/sec */
+static double run_step(int mode, int nthreads, int cycles, double base_rate)
+{
+    const size_t per_thread = 2 * (size_t)cycles * PMDS_PER_THREAD;
+    struct worker *w = calloc(nthreads, sizeof(*w));
+    uint8_t **maps = calloc(nthreads, sizeof(*maps));
+    double *all = malloc(nthreads * per_thread * sizeof(double));
+    double worst_p99 = 0, start = 0, end = 0, elapsed, rate;
+    unsigned long errors = 0;
+    uint8_t *shared = NULL;
+
+    if (w == NULL || maps == NULL || all == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    if (mode == MODE_SHARED)
+        shared = map_pmds((size_t)nthreads * PMDS_PER_THREAD, &maps[0]);
+
+    pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+    for (int t = 0; t < nthreads; t++) {
+        w[t].pmds = mode == MODE_SHARED ?
+            shared + (size_t)t * PMDS_PER_THREAD * PTE_META_PMD_SIZE :
+            map_pmds(PMDS_PER_THREAD, &maps[t]);
+        w[t].cycles = cycles;
+        w[t].ns = all + t * per_thread;
+        if (pthread_create(&w[t].thread, NULL, worker_main, &w[t]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    for (int t = 0; t < nthreads; t++)
+        pthread_join(w[t].thread, NULL);
+    pthread_barrier_destroy(&start_barrier);
+
+    // Workers may run before this thread leaves the barrier, so the run spans
+    // from the earliest worker start to the latest worker end
+    for (int t = 0; t < nthreads; t++) {
+        if (t == 0 || w[t].start < start)
+            start = w[t].start;
+        if (w[t].end > end)
+            end = w[t].end;
+    }
+    elapsed = end - start;
+
+    // Worst per-thread p99, then the distribution over all threads
+    for (int t = 0; t < nthreads; t++) {
+        qsort(w[t].ns, per_thread, sizeof(double), cmp_double);
+        if (pct(w[t].ns, per_thread, 0.99) > worst_p99)
+            worst_p99 = pct(w[t].ns, per_thread, 0.99);
+        errors += w[t].errors;
+    }
+    qsort(all, nthreads * per_thread, sizeof(double), cmp_double);
+
+    rate = nthreads * per_thread / (elapsed / 1e9);
+    printf("    %7d %12.0f %8.2fx %9.0f %9.0f %9.0f %10.0f %12.0f %7lu\n",
+           nthreads, rate, base_rate > 0 ? rate / base_rate : 1.0,
+           pct(all, nthreads * per_thread, 0.50),
+           pct(all, nthreads * per_thread, 0.99),
+           pct(all, nthreads * per_thread, 0.999),
+           all[nthreads * per_thread - 1], worst_p99, errors);
+    fflush(stdout);
+
+    for (int t = 0; t < nthreads; t++) {
+        if (maps[t] != NULL)
+            munmap(maps[t], ((mode == MODE_SHARED ? (size_t)nthreads : 1) *
+                             PMDS_PER_THREAD + 1) * PTE_META_PMD_SIZE);
+    }
+    free(all);
+    free(maps);
+    free(w);
+    return rate;
+}
+
+int main(int argc, char **argv)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = argc > 1 ? atoi(argv[1]) : (ncpu > 0 ? (int)ncpu : 1);
+    int cycles = argc > 2 ? atoi(argv[2]) : DEFAULT_CYCLES;
+
+    if (max_threads < 1 || cycles < 1) {
+        fprintf(stderr, "Usage: %s [MAX_THREADS [CYCLES]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("\n=== Test12: Enable/Disable Churn Scaling ===\n\n");
+    printf("    backend: %s, %d PMDs per thread, %d enable/disable cycles per PMD\n",
+           pte_meta_backend_name(pte_meta_get_backend()), PMDS_PER_THREAD,
+           cycles);
+
+    for (int mode = MODE_PRIVATE; mode <= MODE_SHARED; mode++) {
+        double base_rate = 0;
+
+        printf("\n--- %s ---\n", mode_names[mode]);
+        printf("    %7s %12s %9s %9s %9s %9s %10s %12s %7s\n", "threads",
+               "ops/sec", "scaling", "p50 ns", "p99 ns", "p99.9 ns", "max ns",
+               "worst p99", "errors");
+
+        // 1, 2, 4, ... threads, ending with max_threads
+        for (int n = 1; n <= max_threads;
+             n = (n < max_threads && n * 2 > max_threads) ? max_threads : n * 2) {
+            double rate = run_step(mode, n, cycles, base_rate);
+
+            if (n == 1)
+                base_rate = rate;
+        }
+    }
+
+    printf("\n    ✓ Test completed successfully\n");
+    return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * test13.c - Lifecycle race stress: enable/disable racing with set/get
+ *
+ * Setter and getter threads hammer random pages of a region while the main
+ * thread toggles metadata on its PMDs. Every call's outcome is counted per op
+ * type (success, ENODATA, EINVAL, EEXIST, other). After each burst of racing
+ * toggles the workers are parked, the region is disabled and re-enabled, and
+ * every page is read back: a fresh PTE page must not expose metadata from
+ * before the disable.
+ *
+ * Usage: ./test13 [SECONDS [SETTERS [GETTERS]]]   e.g. ./test13 60 8 8
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "pte_meta_syscalls.h"
+
+#define REGION_PMDS      4
+#define RACE_TOGGLES     16          // unsynchronized toggles per cycle
+#define DEFAULT_SECONDS  2
+#define DEFAULT_SETTERS  2
+#define DEFAULT_GETTERS  2
+#define META_TAG         0x5EB0000000000000ULL
+#define META_TAG_MASK    0xFFFF000000000000ULL
+
+enum { OP_SET, OP_GET, OP_ENABLE, OP_DISABLE, NR_OPS };
+enum { RES_OK, RES_ENODATA, RES_EINVAL, RES_EEXIST, RES_OTHER, NR_RES };
+
+static const char *op_names[NR_OPS] = { "set", "get", "enable", "disable" };
+
+struct worker {
+    pthread_t thread;
+    int id;
+    int setter;
+    unsigned int seed;
+    atomic_int parked;
+    unsigned long counts[NR_OPS][NR_RES];
+    unsigned long corrupt;          // get returned a value nobody wrote
+};
+
+static uint8_t *region;
+static size_t region_pages;
+static size_t page_size;
+static atomic_int stop;
+static atomic_int hold;
+
+static int classify(int ret)
+{
+    if (ret == 0)
+        return RES_OK;
+    switch (errno) {
+    case ENODATA: return RES_ENODATA;
+    case EINVAL:  return RES_EINVAL;
+    case EEXIST:  return RES_EEXIST;
+    default:      return RES_OTHER;
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    uint64_t seq = 0;
+
+    while (!atomic_load(&stop)) {
+        // Stay out of the syscalls while the main thread checks the region
+        if (atomic_load(&hold)) {
+            atomic_store(&w->parked, 1);
+            while (atomic_load(&hold) && !atomic_load(&stop))
+                sched_yield();
+            atomic_store(&w->parked, 0);
+            continue;
+        }
+
+        unsigned long addr = (unsigned long)(region +
+                                             (rand_r(&w->seed) % region_pages) * page_size);
+        uint64_t value;
+
+        if (w->setter) {
+            // Never zero, tagged so that getters can recognize it
+            value = META_TAG | ((uint64_t)w->id << 32) | (++seq & 0xFFFFFFFFULL);
+            w->counts[OP_SET][classify(set_pte_meta(addr, 0, (unsigned long)&value))]++;
+        } else {
+            int res = classify(get_pte_meta(addr, &value));
+
+            w->counts[OP_GET][res]++;
+            if (res == RES_OK && value != 0 && (value & META_TAG_MASK) != META_TAG)
+                w->corrupt++;
+        }
+    }
+    return NULL;
+}
+
+static void toggle_region(int enable, unsigned long counts[NR_OPS][NR_RES])
+{
+    for (int p = 0; p < REGION_PMDS; p++) {
+        unsigned long addr = (unsigned long)(region + p * PTE_META_PMD_SIZE);
+
+        if (enable)
+            counts[OP_ENABLE][classify(enable_pte_meta(addr))]++;
+        else
+            counts[OP_DISABLE][classify(disable_pte_meta(addr))]++;
+    }
+}
+
+/* Park all workers, then collapse and re-expand the region; returns stale pages */
+static unsigned long check_cycle(struct worker *w, int nworkers,
+                                 unsigned long counts[NR_OPS][NR_RES])
+{
+    unsigned long stale = 0;
+
+    atomic_store(&hold, 1);
+    for (int i = 0; i < nworkers; i++)
+        while (!atomic_load(&w[i].parked))
+            sched_yield();
+
+    toggle_region(0, counts);
+    toggle_region(1, counts);
+
+    // A freshly expanded PTE page holds no metadata
+    for (size_t i = 0; i < region_pages; i++) {
+        uint64_t value = 0;
+
+        if (get_pte_meta((unsigned long)(region + i * page_size), &value) == 0 &&
+            value != 0) {
+            if (stale++ == 0)
+                fprintf(stderr, "    ✗ page %zu: stale metadata 0x%llx after "
+                        "disable/enable\n", i, (unsigned long long)value);
+        }
+    }
+
+    atomic_store(&hold, 0);
+    return stale;
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : DEFAULT_SECONDS;
+    int setters = argc > 2 ? atoi(argv[2]) : DEFAULT_SETTERS;
+    int getters = argc > 3 ? atoi(argv[3]) : DEFAULT_GETTERS;
+    int nworkers = setters + getters;
+    unsigned long counts[NR_OPS][NR_RES] = { { 0 } };
+    unsigned long cycles = 0, stale = 0, corrupt = 0;
+    struct timespec t0, t1;
+    struct worker *w;
+    uint8_t *map;
+    double elapsed;
+
+    if (seconds < 1 || setters < 0 || getters < 0 || nworkers < 1) {
+        fprintf(stderr, "Usage: %s [SECONDS [SETTERS [GETTERS]]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    page_size = sysconf(_SC_PAGESIZE);
+    region_pages = REGION_PMDS * PTE_META_PMD_SIZE / page_size;
+
+    printf("\n=== Test13: Lifecycle Race Stress ===\n\n");
+    printf("    backend: %s, %d s, %d setters, %d getters, %d PMDs (%zu pages)\n",
+           pte_meta_backend_name(pte_meta_get_backend()), seconds, setters,
+           getters, REGION_PMDS, region_pages);
+
+    // PMD-aligned region with every page populated
+    map = mmap(NULL, (REGION_PMDS + 1) * PTE_META_PMD_SIZE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+    region = (uint8_t *)(((unsigned long)map + PTE_META_PMD_SIZE - 1) &
+                         ~(PTE_META_PMD_SIZE - 1));
+#ifdef MADV_NOHUGEPAGE
+    madvise(region, REGION_PMDS * PTE_META_PMD_SIZE, MADV_NOHUGEPAGE);
+#endif
+    memset(region, 0x5A, REGION_PMDS * PTE_META_PMD_SIZE);
+    toggle_region(1, counts);
+
+    w = calloc(nworkers, sizeof(*w));
+    if (w == NULL) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < nworkers; i++) {
+        w[i].id = i;
+        w[i].setter = i < setters;
+        w[i].seed = 0x13u + i;
+        if (pthread_create(&w[i].thread, NULL, worker_main, &w[i]) != 0) {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do {
+        // Toggle the region under load, then check it with the workers parked
+        for (int i = 0; i < RACE_TOGGLES; i++)
+            toggle_region(i & 1, counts);
+        stale += check_cycle(w, nworkers, counts);
+        cycles++;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    } while (elapsed < seconds);
+
+    atomic_store(&stop, 1);
+    for (int i = 0; i < nworkers; i++) {
+        pthread_join(w[i].thread, NULL);
+        for (int op = 0; op < NR_OPS; op++)
+            for (int r = 0; r < NR_RES; r++)
+                counts[op][r] += w[i].counts[op][r];
+        corrupt += w[i].corrupt;
+    }
+
+    toggle_region(0, counts);
+
+    printf("\n    %-8s %12s %12s %12s %10s %10s %10s %8s\n", "op", "total",
+           "ops/sec", "success", "ENODATA", "EINVAL", "EEXIST", "other");
+    for (int op = 0; op < NR_OPS; op++) {
+        unsigned long total = 0;
+
+        for (int r = 0; r < NR_RES; r++)
+            total += counts[op][r];
+        printf("    %-8s %12lu %12.0f %12lu %10lu %10lu %10lu %8lu\n",
+               op_names[op], total, total / elapsed, counts[op][RES_OK],
+               counts[op][RES_ENODATA], counts[op][RES_EINVAL],
+               counts[op][RES_EEXIST], counts[op][RES_OTHER]);
+    }
+
+    printf("\n    %lu disable/enable cycles checked, %lu stale pages, "
+           "%lu corrupt reads\n", cycles, stale, corrupt);
+
+    munmap(map, (REGION_PMDS + 1) * PTE_META_PMD_SIZE);
+    free(w);
+
+    if (stale != 0 || corrupt != 0) {
+        printf("    ✗ Metadata leaked across a disable/enable cycle\n");
+        return EXIT_FAILURE;
+    }
+    for (int op = 0; op < NR_OPS; op++) {
+        if (counts[op][RES_OTHER] != 0) {
+            printf("    ✗ %s returned unexpected errors\n", op_names[op]);
+            return EXIT_FAILURE;
+        }
+    }
+    printf("    ✓ Test completed successfully\n");
+    return 0;
+}
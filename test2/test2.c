@@ -13,10 +13,7 @@
 #include <time.h>
 #include <string.h>
 
-#define SYS_enable_pte_meta   469
-#define SYS_disable_pte_meta  470
-#define SYS_set_pte_meta      471
-#define SYS_get_pte_meta      472
+#include "pte_meta_syscalls.h"
 
 #define META_VALUE_DIRECT 0xCAFEBABEDEADBEEFULL
 
@@ -35,7 +32,7 @@ static void verify_pattern(const char *stage, const uint8_t *b, size_t n)
 
 static void call_or_die_1(long nr, unsigned long a1, const char *name)
 {
-    long r = syscall(nr, a1);
+    long r = pte_meta_syscall(nr, a1, 0, 0);
     if (r < 0) { perror(name); exit(EXIT_FAILURE); }
 }
 
@@ -43,7 +40,7 @@ static void call_or_die_3(long nr, unsigned long a1,
                           unsigned long a2, unsigned long a3,
                           const char *name)
 {
-    long r = syscall(nr, a1, a2, a3);
+    long r = pte_meta_syscall(nr, a1, a2, a3);
     if (r < 0) { perror(name); exit(EXIT_FAILURE); }
 }
 
@@ -88,7 +85,7 @@ static void test_mdp0(uint8_t *buf, size_t ps)
     
     // Get metadata with MDP=0
     clock_gettime(CLOCK_MONOTONIC, &start);
-    long r = syscall(SYS_get_pte_meta, (unsigned long)buf, &retrieved_meta);
+    long r = get_pte_meta((unsigned long)buf, &retrieved_meta);
     clock_gettime(CLOCK_MONOTONIC, &end);
     time_taken = get_time_diff(&start, &end);
     print_timing("get_pte_meta MDP=0", time_taken);
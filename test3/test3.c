@@ -13,16 +13,18 @@
 #include <time.h>
 #include <string.h>
 
-#define SYS_enable_pte_meta   469
-#define SYS_disable_pte_meta  470
-#define SYS_set_pte_meta      471
-#define SYS_get_pte_meta      472
+#include "pte_meta_syscalls.h"
 
 // Test payload for MDP=1 structured buffer
 #define PAYLOAD_SIZE 16
 
-/* Structure for MDP=1 buffer header */
-struct metadata_header {
+/*
+ * Structure for MDP=1 buffer header, in the packed layout test3 sends to the
+ * kernel. The emul backend models the 16-byte struct metadata_header from
+ * pte_meta_syscalls.h instead, so the MDP=1 round trip only runs against
+ * the kernel.
+ */
+struct mdp1_header {
     uint16_t version;
     uint16_t type;
     uint32_t length;
@@ -43,7 +45,7 @@ static void verify_pattern(const char *stage, const uint8_t *b, size_t n)
 
 static void call_or_die_1(long nr, unsigned long a1, const char *name)
 {
-    long r = syscall(nr, a1);
+    long r = pte_meta_syscall(nr, a1, 0, 0);
     if (r < 0) { perror(name); exit(EXIT_FAILURE); }
 }
 
@@ -51,7 +53,7 @@ static void call_or_die_3(long nr, unsigned long a1,
                           unsigned long a2, unsigned long a3,
                           const char *name)
 {
-    long r = syscall(nr, a1, a2, a3);
+    long r = pte_meta_syscall(nr, a1, a2, a3);
     if (r < 0) { perror(name); exit(EXIT_FAILURE); }
 }
 
@@ -91,9 +93,15 @@ static void test_mdp1(uint8_t *buf, size_t ps)
     clock_gettime(CLOCK_MONOTONIC, &end);
     time_taken = get_time_diff(&start, &end);
     print_timing("enable_pte_meta", time_taken);
+
+    if (pte_meta_get_backend() == PTE_META_BACKEND_EMUL) {
+        printf("    MDP=1 round trip skipped: the emul backend does not model "
+               "the packed %zu-byte header\n", sizeof(struct mdp1_header));
+        return;
+    }
     
     // Prepare structured buffer for MDP=1
-    struct metadata_header header = {
+    struct mdp1_header header = {
         .version = 1,
         .type = 0x1234,
         .length = PAYLOAD_SIZE
@@ -136,7 +144,7 @@ static void test_mdp1(uint8_t *buf, size_t ps)
     }
     
     clock_gettime(CLOCK_MONOTONIC, &start);
-    long r = syscall(SYS_get_pte_meta, (unsigned long)buf, retrieved_buffer);
+    long r = get_pte_meta((unsigned long)buf, retrieved_buffer);
     clock_gettime(CLOCK_MONOTONIC, &end);
     time_taken = get_time_diff(&start, &end);
     print_timing("get_pte_meta MDP=1", time_taken);
@@ -147,8 +155,8 @@ static void test_mdp1(uint8_t *buf, size_t ps)
     }
     
     // Verify retrieved structured buffer
-    struct metadata_header *retrieved_header = (struct metadata_header *)retrieved_buffer;
-    uint8_t *retrieved_payload = retrieved_buffer + sizeof(struct metadata_header);
+    struct mdp1_header *retrieved_header = (struct mdp1_header *)retrieved_buffer;
+    uint8_t *retrieved_payload = retrieved_buffer + sizeof(struct mdp1_header);
     
     printf("    Retrieved metadata:\n");
     printf("      Header: version=%d, type=0x%x, length=%d\n", 
@@ -13,10 +13,7 @@
 #include <string.h>
 #include <time.h>
 
-#define SYS_enable_pte_meta   469
-#define SYS_disable_pte_meta  470
-#define SYS_set_pte_meta      471
-#define SYS_get_pte_meta      472
+#include "pte_meta_syscalls.h"
 
 static void fill(uint8_t *b, size_t n)
 { for (size_t i = 0; i < n; ++i) b[i] = (uint8_t)(i & 0xFF); }
@@ -54,7 +51,7 @@ static void test_get_without_expansion(uint8_t *buf, size_t ps)
     
     // Try to get metadata when page table is not expanded
     clock_gettime(CLOCK_MONOTONIC, &start);
-    long r = syscall(SYS_get_pte_meta, (unsigned long)buf, &buffer);
+    long r = get_pte_meta((unsigned long)buf, &buffer);
     clock_gettime(CLOCK_MONOTONIC, &end);
     time_taken = get_time_diff(&start, &end);
     print_timing("get_pte_meta", time_taken);
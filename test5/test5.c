@@ -13,10 +13,7 @@
 #include <string.h>
 #include <time.h>
 
-#define SYS_enable_pte_meta   469
-#define SYS_disable_pte_meta  470
-#define SYS_set_pte_meta      471
-#define SYS_get_pte_meta      472
+#include "pte_meta_syscalls.h"
 
 #define NUM_PAGES 4  // Test 4 pages within same page table
 
@@ -46,7 +43,7 @@ static void print_timing(const char *operation, double nanoseconds)
 
 static void call_or_die_1(long nr, unsigned long a1, const char *name)
 {
-    long r = syscall(nr, a1);
+    long r = pte_meta_syscall(nr, a1, 0, 0);
     if (r < 0) { perror(name); exit(EXIT_FAILURE); }
 }
 
@@ -54,7 +51,7 @@ static void call_or_die_3(long nr, unsigned long a1,
                           unsigned long a2, unsigned long a3,
                           const char *name)
 {
-    long r = syscall(nr, a1, a2, a3);
+    long r = pte_meta_syscall(nr, a1, a2, a3);
     if (r < 0) { perror(name); exit(EXIT_FAILURE); }
 }
 
@@ -105,7 +102,7 @@ static void test_multiple_pages(uint8_t **pages, size_t ps)
         snprintf(syscall_name, sizeof(syscall_name), "get_pte_meta page %d", i);
         
         clock_gettime(CLOCK_MONOTONIC, &start);
-        long r = syscall(SYS_get_pte_meta, (unsigned long)pages[i], &retrieved_meta);
+        long r = get_pte_meta((unsigned long)pages[i], &retrieved_meta);
         clock_gettime(CLOCK_MONOTONIC, &end);
         time_taken = get_time_diff(&start, &end);
         
@@ -13,10 +13,7 @@
 #include <string.h>
 #include <time.h>
 
-#define SYS_enable_pte_meta   469
-#define SYS_disable_pte_meta  470
-#define SYS_set_pte_meta      471
-#define SYS_get_pte_meta      472
+#include "pte_meta_syscalls.h"
 
 static void fill(uint8_t *b, size_t n)
 { for (size_t i = 0; i < n; ++i) b[i] = (uint8_t)(i & 0xFF); }
@@ -44,7 +41,7 @@ static void print_timing(const char *operation, double nanoseconds)
 
 static void call_or_die_1(long nr, unsigned long a1, const char *name)
 {
-    long r = syscall(nr, a1);
+    long r = pte_meta_syscall(nr, a1, 0, 0);
     if (r < 0) { perror(name); exit(EXIT_FAILURE); }
 }
 
@@ -107,7 +104,7 @@ static void test_double_enable_error(uint8_t *buf, size_t ps)
     // Second enable should fail with -EEXIST
     printf("    Second enable (should fail with EEXIST)...\n");
     clock_gettime(CLOCK_MONOTONIC, &start);
-    long r = syscall(SYS_enable_pte_meta, (unsigned long)buf);
+    long r = enable_pte_meta((unsigned long)buf);
     clock_gettime(CLOCK_MONOTONIC, &end);
     time_taken = get_time_diff(&start, &end);
     print_timing("second enable", time_taken);
@@ -1,5 +1,13 @@
 /*
- * test9.c - Tests PTE meta operations with 1000 iterations and statistics
+ * test9.c - Tests PTE meta operations over many iterations with statistics
+ *
+ * Usage: ./test9 [ITERATIONS] [clflush|tlb|mprotect] [--dump=FILE]
+ *   Latencies go into fixed-size histograms, so ITERATIONS (default 10000)
+ *   can be raised to 10^8 and beyond without using more memory.
+ *   With an eviction method, the iterations are repeated with the page
+ *   evicted before every set and get, and cold and warm latencies are
+ *   reported side by side.
+ *   --dump writes every histogram as CSV for plotting the latency tails.
  */
 
 #define _GNU_SOURCE
@@ -13,15 +21,18 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <sched.h>
 
-#define SYS_enable_pte_meta   469
-#define SYS_disable_pte_meta  470
-#define SYS_set_pte_meta      471
-#define SYS_get_pte_meta      472
+#include "pte_meta_syscalls.h"
 
-#define ITERATIONS 10000
+#define DEFAULT_ITERATIONS 10000
+#define BASELINE_MAX_ITERATIONS 100000
 #define META_VALUE_BASE 0xCAFEBABEDEADBEEFULL
 
+static long iterations = DEFAULT_ITERATIONS;
+static struct pte_meta_hist set_hist, get_hist;
+static struct pte_meta_hist cold_set_hist, cold_get_hist;
+
 static void fill(uint8_t *b, size_t n)
 { for (size_t i = 0; i < n; ++i) b[i] = (uint8_t)(i & 0xFF); }
 
@@ -41,6 +52,12 @@ static double get_time_diff(struct timespec *start, struct timespec *end)
            (end->tv_nsec - start->tv_nsec);
 }
 
+static uint64_t get_time_diff_ns(struct timespec *start, struct timespec *end)
+{
+    return (uint64_t)(end->tv_sec - start->tv_sec) * 1000000000ULL +
+           end->tv_nsec - start->tv_nsec;
+}
+
 static void print_timing(const char *operation, double nanoseconds)
 {
     printf("    %-20s: %10.0f ns\n", operation, nanoseconds);
@@ -48,7 +65,7 @@ static void print_timing(const char *operation, double nanoseconds)
 
 static void call_or_die_1(long nr, unsigned long a1, const char *name)
 {
-    long r = syscall(nr, a1);
+    long r = pte_meta_syscall(nr, a1, 0, 0);
     if (r < 0) { perror(name); exit(EXIT_FAILURE); }
 }
 
@@ -56,39 +73,124 @@ static void call_or_die_3(long nr, unsigned long a1,
                           unsigned long a2, unsigned long a3,
                           const char *name)
 {
-    long r = syscall(nr, a1, a2, a3);
+    long r = pte_meta_syscall(nr, a1, a2, a3);
     if (r < 0) { perror(name); exit(EXIT_FAILURE); }
 }
 
-static void calculate_stats(double *times, int n, double *min, double *max, 
-                          double *mean, double *stddev)
+// Pin to the CPU we start on, so the baseline and the ops share one core
+static int pin_to_current_cpu(void)
+{
+    cpu_set_t set;
+    int cpu = sched_getcpu();
+
+    if (cpu < 0)
+        return -1;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        return -1;
+    return cpu;
+}
+
+static void print_baseline(const struct pte_meta_baseline *b)
+{
+    printf("    Null syscall (getppid):   min %6.0f ns, mean %6.0f ns (%d calls)\n",
+           b->syscall_min, b->syscall_mean, b->iterations);
+    printf("    vDSO call (gettimeofday): min %6.0f ns, mean %6.0f ns (%d calls)\n",
+           b->vdso_min, b->vdso_mean, b->iterations);
+    printf("    CPU vulnerabilities:\n");
+    pte_meta_print_mitigations("      ");
+}
+
+// Set then get every iteration, evicting the page before each op
+static void run_cold_iterations(uint8_t *buf, size_t ps, struct pte_meta_evict *ev,
+                                struct pte_meta_hist *set_h, struct pte_meta_hist *get_h)
 {
-    double sum = 0.0, sum_sq = 0.0;
-    *min = times[0];
-    *max = times[0];
-
-    for (int i = 0; i < n; i++) {
-        sum += times[i];
-        sum_sq += times[i] * times[i];
-        if (times[i] < *min) *min = times[i];
-        if (times[i] > *max) *max = times[i];
+    struct timespec start, end;
+
+    for (long i = 0; i < iterations; i++) {
+        uint64_t meta_value = META_VALUE_BASE + i;
+        uint64_t retrieved_meta;
+
+        pte_meta_evict(ev, buf, ps);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        call_or_die_3(SYS_set_pte_meta, (unsigned long)buf, 0,
+                      (unsigned long)&meta_value, "set_pte_meta");
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        pte_meta_hist_record(set_h, get_time_diff_ns(&start, &end));
+
+        pte_meta_evict(ev, buf, ps);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        long r = get_pte_meta((unsigned long)buf, &retrieved_meta);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        pte_meta_hist_record(get_h, get_time_diff_ns(&start, &end));
+
+        if (r < 0 || retrieved_meta != meta_value) {
+            fprintf(stderr, "\n    ✗ cold get_pte_meta failed at iteration %ld\n", i);
+            exit(EXIT_FAILURE);
+        }
     }
+}
 
-    *mean = sum / n;
-    *stddev = sqrt((sum_sq / n) - (*mean * *mean));
+// Stats of one histogram, with the cold/warm ratio when warm is given
+static void print_stats(const char *title, const struct pte_meta_hist *h,
+                        const struct pte_meta_hist *warm)
+{
+    printf("%s (%llu iterations):\n", title, (unsigned long long)h->count);
+    pte_meta_hist_print(h, "    ");
+    if (warm != NULL && warm->mean > 0)
+        printf("    Mean vs warm: %.1fx\n", h->mean / warm->mean);
 }
 
-int main(void)
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [ITERATIONS] [clflush|tlb|mprotect] [--dump=FILE]\n",
+            prog);
+}
+
+int main(int argc, char **argv)
 {
     struct timespec start, end;
     double time_taken;
     size_t ps = sysconf(_SC_PAGESIZE);
     uint8_t *buf;
-    double set_times[ITERATIONS];
-    double get_times[ITERATIONS];
-    int i;
+    struct pte_meta_baseline baseline;
+    struct pte_meta_evict evict;
+    int method = PTE_META_EVICT_NONE;
+    const char *dump_path = NULL;
+    long progress_step;
+    int cpu;
+    long i;
+
+    for (int a = 1; a < argc; a++) {
+        char *end;
+        long n = strtol(argv[a], &end, 10);
+
+        if (!strncmp(argv[a], "--dump=", 7) && argv[a][7] != '\0') {
+            dump_path = argv[a] + 7;
+        } else if (*end == '\0' && end != argv[a]) {
+            if (n < 1) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            iterations = n;
+        } else if ((method = pte_meta_parse_evict(argv[a])) < 0) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    progress_step = iterations >= 10 ? iterations / 10 : 1;
+
+    pte_meta_hist_init(&set_hist);
+    pte_meta_hist_init(&get_hist);
+    pte_meta_hist_init(&cold_set_hist);
+    pte_meta_hist_init(&cold_get_hist);
+    if (pte_meta_evict_init(&evict, method) != 0) {
+        perror("eviction scratch mapping");
+        return EXIT_FAILURE;
+    }
 
-    printf("\n=== Test9: %d-Iteration Statistics Test ===\n\n", ITERATIONS);
+    printf("\n=== Test9: %ld-Iteration Statistics Test ===\n\n", iterations);
 
     // Section 1: Setup
     printf("--- Setup ---\n");
@@ -104,6 +206,12 @@ int main(void)
 
     mlock(buf, ps);
 
+    cpu = pin_to_current_cpu();
+    if (cpu >= 0)
+        printf("    Pinned to CPU %d\n", cpu);
+    else
+        printf("    ⚠ Could not pin to a CPU, timings may migrate\n");
+
     clock_gettime(CLOCK_MONOTONIC, &start);
     fill(buf, ps);
     clock_gettime(CLOCK_MONOTONIC, &end);
@@ -120,15 +228,21 @@ int main(void)
     time_taken = get_time_diff(&start, &end);
     print_timing("enable_pte_meta", time_taken);
 
-    // Section 2: Iterative Set/Get Operations
-    printf("\n--- %d Set/Get Iterations ---\n", ITERATIONS);
+    // Section 2: Kernel entry/exit cost, same CPU and iteration count
+    printf("\n--- Syscall Entry Baseline ---\n");
+    pte_meta_measure_baseline(iterations < BASELINE_MAX_ITERATIONS ?
+                              (int)iterations : BASELINE_MAX_ITERATIONS, &baseline);
+    print_baseline(&baseline);
+
+    // Section 3: Iterative Set/Get Operations
+    printf("\n--- %ld Set/Get Iterations ---\n", iterations);
     printf("    Progress: ");
     fflush(stdout);
     
-    for (i = 0; i < ITERATIONS; i++) {
-        // Show progress every 1000 iterations
-        if (i % 1000 == 0) {
-            printf("%d ", i);
+    for (i = 0; i < iterations; i++) {
+        // Show progress every tenth of the run
+        if (i % progress_step == 0) {
+            printf("%ld ", i);
             fflush(stdout);
         }
         
@@ -141,64 +255,98 @@ int main(void)
         call_or_die_3(SYS_set_pte_meta, (unsigned long)buf, 0, 
                       (unsigned long)&meta_value, "set_pte_meta");
         clock_gettime(CLOCK_MONOTONIC, &end);
-        set_times[i] = get_time_diff(&start, &end);
+        pte_meta_hist_record(&set_hist, get_time_diff_ns(&start, &end));
 
         // Get metadata
         clock_gettime(CLOCK_MONOTONIC, &start);
-        long r = syscall(SYS_get_pte_meta, (unsigned long)buf, &retrieved_meta);
+        long r = get_pte_meta((unsigned long)buf, &retrieved_meta);
         clock_gettime(CLOCK_MONOTONIC, &end);
-        get_times[i] = get_time_diff(&start, &end);
+        pte_meta_hist_record(&get_hist, get_time_diff_ns(&start, &end));
         
         if (r < 0) {
-            fprintf(stderr, "\n    ✗ get_pte_meta failed at iteration %d: %s\n", 
+            fprintf(stderr, "\n    ✗ get_pte_meta failed at iteration %ld: %s\n", 
                     i, strerror(errno));
             exit(EXIT_FAILURE);
         }
 
         // Verify metadata value
         if (retrieved_meta != meta_value) {
-            fprintf(stderr, "\n    ✗ meta verification failed at iteration %d\n", i);
+            fprintf(stderr, "\n    ✗ meta verification failed at iteration %ld\n", i);
             fprintf(stderr, "      expected: 0x%llx, got: 0x%llx\n",
                     (unsigned long long)meta_value, (unsigned long long)retrieved_meta);
             exit(EXIT_FAILURE);
         }
     }
     
-    printf("%d\n    ✓ All iterations completed successfully\n", ITERATIONS);
+    printf("%ld\n    ✓ All iterations completed successfully\n", iterations);
 
-    // Section 3: Statistics Analysis
+    if (method != PTE_META_EVICT_NONE) {
+        printf("\n--- %ld Cold Set/Get Iterations (eviction: %s) ---\n",
+               iterations, pte_meta_evict_name(method));
+        run_cold_iterations(buf, ps, &evict, &cold_set_hist, &cold_get_hist);
+        printf("    ✓ All cold iterations completed successfully\n");
+    }
+
+    // Section 4: Statistics Analysis
     printf("\n--- Performance Statistics ---\n");
-    
-    double min, max, mean, stddev;
-
-    calculate_stats(set_times, ITERATIONS, &min, &max, &mean, &stddev);
-    printf("Set PTE Meta (%d iterations):\n", ITERATIONS);
-    printf("    Min:     %10.0f ns\n", min);
-    printf("    Max:     %10.0f ns\n", max);
-    printf("    Mean:    %10.0f ns\n", mean);
-    printf("    StdDev:  %10.0f ns\n", stddev);
-
-    calculate_stats(get_times, ITERATIONS, &min, &max, &mean, &stddev);
-    printf("\nGet PTE Meta (%d iterations):\n", ITERATIONS);
-    printf("    Min:     %10.0f ns\n", min);
-    printf("    Max:     %10.0f ns\n", max);
-    printf("    Mean:    %10.0f ns\n", mean);
-    printf("    StdDev:  %10.0f ns\n", stddev);
+    print_stats("Set PTE Meta", &set_hist, NULL);
+    printf("\n");
+    print_stats("Get PTE Meta", &get_hist, NULL);
 
-    // Performance analysis
-    double total_set_time = 0, total_get_time = 0;
-    for (i = 0; i < ITERATIONS; i++) {
-        total_set_time += set_times[i];
-        total_get_time += get_times[i];
+    // Subtract the null syscall, the rest is the metadata op itself
+    printf("\nNet of Syscall Entry (minus null syscall):\n");
+    if (pte_meta_get_backend() == PTE_META_BACKEND_EMUL) {
+        printf("    n/a (emul backend: metadata ops do not enter the kernel)\n");
+    } else {
+        printf("    Set:     min %10.0f ns, mean %10.0f ns\n",
+               pte_meta_net_ns(set_hist.min, baseline.syscall_min),
+               pte_meta_net_ns(set_hist.mean, baseline.syscall_mean));
+        printf("    Get:     min %10.0f ns, mean %10.0f ns\n",
+               pte_meta_net_ns(get_hist.min, baseline.syscall_min),
+               pte_meta_net_ns(get_hist.mean, baseline.syscall_mean));
     }
-    
+
+    if (method != PTE_META_EVICT_NONE) {
+        char title[64];
+
+        snprintf(title, sizeof(title), "Cold Set PTE Meta, eviction: %s",
+                 pte_meta_evict_name(method));
+        printf("\n");
+        print_stats(title, &cold_set_hist, &set_hist);
+        snprintf(title, sizeof(title), "Cold Get PTE Meta, eviction: %s",
+                 pte_meta_evict_name(method));
+        printf("\n");
+        print_stats(title, &cold_get_hist, &get_hist);
+    }
+
+    // Performance analysis
+    double total_set_time = set_hist.mean * set_hist.count;
+    double total_get_time = get_hist.mean * get_hist.count;
+
     printf("\nPerformance Summary:\n");
     printf("    Total set time:  %10.0f ms\n", total_set_time / 1e6);
     printf("    Total get time:  %10.0f ms\n", total_get_time / 1e6);
-    printf("    Set throughput:  %10.0f ops/sec\n", ITERATIONS / (total_set_time / 1e9));
-    printf("    Get throughput:  %10.0f ops/sec\n", ITERATIONS / (total_get_time / 1e9));
+    printf("    Set throughput:  %10.0f ops/sec\n", iterations / (total_set_time / 1e9));
+    printf("    Get throughput:  %10.0f ops/sec\n", iterations / (total_get_time / 1e9));
+
+    if (dump_path != NULL) {
+        FILE *fp = fopen(dump_path, "w");
+
+        if (fp == NULL) {
+            perror(dump_path);
+            exit(EXIT_FAILURE);
+        }
+        pte_meta_hist_dump(&set_hist, fp, "set", 1);
+        pte_meta_hist_dump(&get_hist, fp, "get", 0);
+        if (method != PTE_META_EVICT_NONE) {
+            pte_meta_hist_dump(&cold_set_hist, fp, "cold_set", 0);
+            pte_meta_hist_dump(&cold_get_hist, fp, "cold_get", 0);
+        }
+        fclose(fp);
+        printf("    Histograms written to %s\n", dump_path);
+    }
 
-    // Section 4: Cleanup
+    // Section 5: Cleanup
     printf("\n--- Cleanup ---\n");
     
     clock_gettime(CLOCK_MONOTONIC, &start);
@@ -212,6 +360,7 @@ int main(void)
 
     munlock(buf, ps);
     free(buf);
+    pte_meta_evict_destroy(&evict);
 
     return 0;
 } 
\ No newline at end of file